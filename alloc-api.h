@@ -21,5 +21,11 @@ struct page;
 static int maybe_reallocate(struct page *pg, size_type old_size,
 			    size_type new_size);
 
+/* get_alloc_size() returns how many bytes the allocation of pg->data actually
+ * takes, which may be more than get_size_primary(pg), or get_size_primary(pg)
+ * if the allocator can't tell.
+ */
+static size_type get_alloc_size(const struct page *pg);
+
 
 #endif // ALLOC_API_H
@@ -2,7 +2,16 @@
 #define USZRAM_BASIC_DEF_H
 
 
-#define NO_ALLOC_METADATA
+#include "../uszram.h"
+
+
+#if USZRAM_INLINE_BYTES
+struct alloc_data {
+	_Bool inlined;		// Data is in pg->inline_data, not on the heap
+};
+#else
+#  define NO_ALLOC_METADATA
+#endif
 
 
 #endif // USZRAM_BASIC_DEF_H
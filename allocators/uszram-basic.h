@@ -3,27 +3,58 @@
 
 
 #include <stdlib.h>
+#ifdef __GLIBC__
+#  include <malloc.h>
+#endif
 
 #include "../alloc-api.h"
+#include "../compr-api.h"
 #include "../uszram-page.h"
 
 
 static int maybe_reallocate(struct page *pg, size_type old_size,
 			    size_type new_size)
 {
+#if USZRAM_INLINE_BYTES
+	// Data moving in or out of pg->inline_data is copied there later by the
+	// compressor's write_compressed(), so the old data needn't be kept
+	const _Bool to_inline = new_size && new_size <= USZRAM_INLINE_BYTES;
+	if (pg->alloc_data.inlined || to_inline) {
+		int ret = 0;
+		if (!pg->alloc_data.inlined) {
+			free(pg_data(pg));
+			ret = -old_size;
+		}
+		pg->alloc_data.inlined = to_inline;
+		if (!to_inline) {
+			set_pg_data(pg, new_size ? malloc(new_size) : NULL);
+			ret = new_size;
+		}
+		return ret;
+	}
+#endif
 	if (old_size == new_size)
 		return 0;
 	if (new_size == 0) {
-		free(pg->data);
-		pg->data = NULL;
+		free(pg_data(pg));
+		set_pg_data(pg, NULL);
 	} else if (new_size < old_size) {
-		pg->data = realloc(pg->data, new_size);
+		set_pg_data(pg, realloc(pg_data(pg), new_size));
 	} else {
-		free(pg->data);
-		pg->data = malloc(new_size);
+		free(pg_data(pg));
+		set_pg_data(pg, malloc(new_size));
 	}
 	return new_size - old_size;
 }
 
+static size_type get_alloc_size(const struct page *pg)
+{
+#ifdef __GLIBC__
+	if (!pg_is_inline(pg))
+		return malloc_usable_size(pg_data(pg));
+#endif
+	return get_size_primary(pg);
+}
+
 
 #endif // USZRAM_BASIC_H
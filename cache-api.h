@@ -5,7 +5,26 @@
 #include "uszram-def.h"
 
 
-#ifndef USZRAM_NO_CACHING
+#if !defined USZRAM_NO_CACHING && USZRAM_PACKED_PAGE
+#  define PG_CACHE_DO(pg, call) do {				\
+		struct cache_data cache_ = pg_cache(pg);	\
+		call;						\
+		set_pg_cache(pg, cache_);			\
+	} while (0)
+#  define UNCACHE_PG(pg, d)       uncache_pg   (pg_cache(pg), d)
+#  define CACHE_READ(pg, b, s, d) cache_read   (pg_cache(pg), b, s, d)
+#  define GET_PG_RANGES(pg, b, r) get_pg_ranges(pg_cache(pg), b, r)
+#  define BYTES_NEEDED(pg, b, y)  bytes_needed (pg_cache(pg), b)
+#  define CACHE_LOG_READ(pg, b)   PG_CACHE_DO(pg, cache_log_read(&cache_, b))
+#  define CACHE_PG_COPY(pg, s, d) PG_CACHE_DO(pg, cache_pg_copy(&cache_, s, d))
+#  define CACHE_PG(pg, d)         PG_CACHE_DO(pg, cache_pg(&cache_, d))
+#  define CACHE_RAW_PG_COPY(pg, s, d) \
+	  PG_CACHE_DO(pg, cache_raw_pg_copy(&cache_, s, d))
+#  define CACHE_RESET(pg)         PG_CACHE_DO(pg, cache_reset(&cache_))
+#  define CACHE_INIT(pg)          PG_CACHE_DO(pg, cache_init(&cache_))
+#  define CACHE_EXIT()            cache_exit()
+#  define SET_PG_CACHE(pg, c)     set_pg_cache(pg, c)
+#elif !defined USZRAM_NO_CACHING
 #  define UNCACHE_PG(pg, d)       uncache_pg    ( (pg)->cache_data, d)
 #  define CACHE_READ(pg, b, s, d) cache_read    ( (pg)->cache_data, b, s, d)
 #  define GET_PG_RANGES(pg, b, r) get_pg_ranges ( (pg)->cache_data, b, r)
@@ -13,18 +32,25 @@
 #  define CACHE_LOG_READ(pg, b)   cache_log_read(&(pg)->cache_data, b)
 #  define CACHE_PG_COPY(pg, s, d) cache_pg_copy (&(pg)->cache_data, s, d)
 #  define CACHE_PG(pg, d)         cache_pg      (&(pg)->cache_data, d)
+#  define CACHE_RAW_PG_COPY(pg, s, d) \
+				  cache_raw_pg_copy(&(pg)->cache_data, s, d)
 #  define CACHE_RESET(pg)         cache_reset   (&(pg)->cache_data)
 #  define CACHE_INIT(pg)          cache_init    (&(pg)->cache_data)
+#  define CACHE_EXIT()            cache_exit    ()
+#  define SET_PG_CACHE(pg, c)     ((pg)->cache_data = (c))
 #else
 #  define UNCACHE_PG(pg, d)
-#  define CACHE_READ(pg, b, s, d)
+#  define CACHE_READ(pg, b, s, d) memcpy(d, (s) + (b).offset, (b).count)
 #  define GET_PG_RANGES(pg, b, r) 1
 #  define BYTES_NEEDED(pg, b, y)  (y.offset + y.count)
 #  define CACHE_LOG_READ(pg, b)
 #  define CACHE_PG_COPY(pg, s, d)
 #  define CACHE_PG(pg, d)
+#  define CACHE_RAW_PG_COPY(pg, s, d)
 #  define CACHE_RESET(pg)
 #  define CACHE_INIT(pg)
+#  define CACHE_EXIT()
+#  define SET_PG_CACHE(pg, c)
 #endif
 
 /* MAX_PG_RANGES expands to the maximum number of disjoint ranges that a single
@@ -32,6 +58,11 @@
  * the ranges contiguous in the (possibly out-of-order) page.
  */
 
+/* CACHE_PACKED_BITS, if defined, expands to the number of bits needed to hold
+ * struct cache_data, which must then be a single byte. This lets the caching
+ * strategy be used with USZRAM_PACKED_PAGE.
+ */
+
 struct cache_data;
 
 /* uncache_pg() puts the blocks in 'data' in their original order according to
@@ -80,6 +111,14 @@ static inline void cache_pg_copy(struct cache_data *cache,
 				 const char src[static PAGE_SIZE],
 				 char dest[static PAGE_SIZE]);
 
+/* cache_raw_pg_copy() is like cache_pg_copy() but src is in its original order
+ * rather than the order described by 'cache', as when a whole page of new data
+ * is written.
+ */
+static inline void cache_raw_pg_copy(struct cache_data *cache,
+				     const char src[static PAGE_SIZE],
+				     char dest[static PAGE_SIZE]);
+
 /* cache_reset() resets any metadata in 'cache' to reflect that nothing is
  * cached.
  */
@@ -90,5 +129,10 @@ static inline void cache_reset(struct cache_data *cache);
  */
 static inline void cache_init(struct cache_data *cache);
 
+/* cache_exit() forgets anything learned across pages, so that the next
+ * uszram_init() starts afresh. It's called once every page has been deleted.
+ */
+static inline void cache_exit(void);
+
 
 #endif // CACHE_API_H
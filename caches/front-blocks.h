@@ -0,0 +1,188 @@
+/* front-blocks.h implements the page layout shared by listn-cache.h and
+ * global-cache.h: n blocks listed in front[] are stored, in that order, at the
+ * beginning of the page, and the rest of the blocks follow in their original
+ * order. n can be 0, which describes a page in its natural order.
+ *
+ * An uncached block b is stored at block n + b - rank, where rank is the number
+ * of cached blocks before b. The functions below walk the cached blocks in
+ * ascending order to split ranges at them.
+ */
+
+#ifndef FRONT_BLOCKS_H
+#define FRONT_BLOCKS_H
+
+
+#include <string.h>
+
+#include "../uszram-def.h"
+
+
+#define FRONT_MAX_SLOTS 64u
+
+
+/* front_order() writes to order the indices of front sorted by the blocks in
+ * them, so that front[order[0]] < front[order[1]] < ...
+ */
+static inline void front_order(unsigned char n, const unsigned char *front,
+			       unsigned char *order)
+{
+	for (unsigned char i = 0; i < n; ++i) {
+		unsigned char j = i;
+		for (; j > 0 && front[order[j - 1]] > front[i]; --j)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+}
+
+/* front_push() appends the range of blocks starting at 'start' to ret, which
+ * has n elements, merging it with the last element if they're contiguous.
+ * Returns the new number of elements.
+ */
+static inline unsigned char front_push(BlkRange *ret, unsigned char n,
+				       uint_least16_t start,
+				       uint_least16_t count)
+{
+	if (n && ret[n - 1].offset + ret[n - 1].count == start) {
+		ret[n - 1].count += count;
+		return n;
+	}
+	ret[n] = BLRNG(start, count);
+	return n + 1;
+}
+
+/* front_uncache() is uncache_pg() for the layout described by n and front.
+ */
+static inline void front_uncache(unsigned char n, const unsigned char *front,
+				 char data[static PAGE_SIZE])
+{
+	unsigned char i = 0;
+	while (i < n && front[i] == i)
+		++i;
+	if (i == n)
+		return;
+
+	unsigned char order[FRONT_MAX_SLOTS];
+	char saved[n * BLOCK_SIZE];
+	front_order(n, front, order);
+	memcpy(saved, data, sizeof saved);
+	// Every uncached block moves toward the beginning of the page, so this
+	// never overwrites a block before it's moved
+	uint_least16_t blk = 0;
+	for (unsigned char rank = 0; rank <= n; ++rank) {
+		const uint_least16_t stop = rank < n ? front[order[rank]]
+						     : BLK_PER_PG;
+		memmove(data + blk * BLOCK_SIZE,
+			data + (n - rank + blk) * BLOCK_SIZE,
+			(stop - blk) * BLOCK_SIZE);
+		if (rank < n)
+			memcpy(data + stop * BLOCK_SIZE,
+			       saved + order[rank] * BLOCK_SIZE, BLOCK_SIZE);
+		blk = stop + 1;
+	}
+}
+
+/* front_read() is cache_read() for the layout described by n and front.
+ */
+static inline void front_read(unsigned char n, const unsigned char *front,
+			      ByteRange byte, const char src[static PAGE_SIZE],
+			      char *dest)
+{
+	unsigned char order[FRONT_MAX_SLOTS], rank = 0;
+	front_order(n, front, order);
+	const size_type end = byte.offset + byte.count;
+	while (byte.offset < end) {
+		const uint_least16_t blk = byte.offset / BLOCK_SIZE;
+		while (rank < n && front[order[rank]] < blk)
+			++rank;
+		size_type stop, from;
+		if (rank < n && front[order[rank]] == blk) {
+			stop = (blk + 1) * BLOCK_SIZE;
+			from = order[rank] * BLOCK_SIZE
+			       + byte.offset % BLOCK_SIZE;
+		} else {
+			stop = rank < n ? front[order[rank]] * BLOCK_SIZE
+					: PAGE_SIZE;
+			from = (n - rank) * BLOCK_SIZE + byte.offset;
+		}
+		const size_type count = (stop < end ? stop : end) - byte.offset;
+		memcpy(dest, src + from, count);
+		dest        += count;
+		byte.offset += count;
+	}
+}
+
+/* front_ranges() is get_pg_ranges() for the layout described by n and front.
+ * ret must have at least 2 * n + 1 elements.
+ */
+static inline unsigned char front_ranges(unsigned char n,
+					 const unsigned char *front,
+					 BlkRange blk, BlkRange *ret)
+{
+	unsigned char order[FRONT_MAX_SLOTS], rank = 0, ret_pos = 0;
+	front_order(n, front, order);
+	const uint_least16_t end = blk.offset + blk.count;
+	while (blk.offset < end) {
+		while (rank < n && front[order[rank]] < blk.offset)
+			++rank;
+		if (rank < n && front[order[rank]] == blk.offset) {
+			ret_pos = front_push(ret, ret_pos, order[rank], 1);
+			++blk.offset;
+			continue;
+		}
+		uint_least16_t stop = rank < n ? front[order[rank]]
+					       : BLK_PER_PG;
+		if (stop > end)
+			stop = end;
+		ret_pos = front_push(ret, ret_pos, n - rank + blk.offset,
+				     stop - blk.offset);
+		blk.offset = stop;
+	}
+	return ret_pos;
+}
+
+/* front_bytes_needed() is bytes_needed() for the layout described by n and
+ * front.
+ */
+static inline size_type front_bytes_needed(unsigned char n,
+					   const unsigned char *front,
+					   BlkRange blk)
+{
+	BlkRange ranges[2 * FRONT_MAX_SLOTS + 1];
+	const unsigned char range_count = front_ranges(n, front, blk, ranges);
+	uint_least16_t ret = 0;
+	for (unsigned char i = 0; i < range_count; ++i)
+		if (ranges[i].offset + ranges[i].count > ret)
+			ret = ranges[i].offset + ranges[i].count;
+	return ret * BLOCK_SIZE;
+}
+
+/* front_relayout() writes to dest the page in src, rearranged from the layout
+ * described by old_n and old to the one described by new_n and new.
+ */
+static inline void front_relayout(unsigned char old_n,
+				  const unsigned char *old,
+				  unsigned char new_n,
+				  const unsigned char *new,
+				  const char src[static PAGE_SIZE],
+				  char dest[static PAGE_SIZE])
+{
+	unsigned char order[FRONT_MAX_SLOTS];
+	front_order(new_n, new, order);
+	for (unsigned char i = 0; i < new_n; ++i)
+		front_read(old_n, old, BYRNG(new[i] * BLOCK_SIZE, BLOCK_SIZE),
+			   src, dest + i * BLOCK_SIZE);
+	dest += new_n * BLOCK_SIZE;
+	uint_least16_t blk = 0;
+	for (unsigned char rank = 0; rank <= new_n; ++rank) {
+		const uint_least16_t stop = rank < new_n ? new[order[rank]]
+							 : BLK_PER_PG;
+		const size_type count = (stop - blk) * BLOCK_SIZE;
+		front_read(old_n, old, BYRNG(blk * BLOCK_SIZE, count), src,
+			   dest);
+		dest += count;
+		blk = stop + 1;
+	}
+}
+
+
+#endif // FRONT_BLOCKS_H
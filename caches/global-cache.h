@@ -0,0 +1,232 @@
+/* global-cache.h learns which blocks are read most often across the whole store
+ * and keeps GLOBAL_SLOTS (set by USZRAM_CACHE_SLOTS) of them at the beginning
+ * of every page it compresses. Where the same blocks are hot in every page
+ * (headers, slot directories, etc.), a page gets the benefit on its very first
+ * read instead of having to discover its own hot blocks, and struct cache_data
+ * shrinks to a single byte per page (two bits with USZRAM_PACKED_PAGE).
+ *
+ * Learning: cache_log_read() samples one in GLOBAL_SAMPLE calls per thread and
+ * adds the blocks read to store-wide counters. Every GLOBAL_RELEARN samples,
+ * one thread sorts the counters to choose the hottest blocks (filling any
+ * remaining slots with the lowest-numbered blocks not chosen) and halves the
+ * counters so that the ordering follows changes in popularity.
+ *
+ * Layouts: the learned ordering is published as one of GLOBAL_LAYOUTS layouts,
+ * and each page records the index of the layout it was compressed with. Layout
+ * 0 is the natural order, which is what a zeroed struct cache_data means.
+ * Layouts 1 and up are learned orderings, each with a count of the pages using
+ * it. Pages compressed from then on take the newest layout, and a layout is
+ * only overwritten by a new ordering once no page uses it, so a page's layout
+ * never changes under it. If every learned layout is still in use, the new
+ * ordering is dropped until some pages are recompressed.
+ */
+
+#ifndef GLOBAL_CACHE_H
+#define GLOBAL_CACHE_H
+
+
+#include <string.h>
+#include <stdatomic.h>
+
+#include "../cache-api.h"
+#include "front-blocks.h"
+
+
+#define GLOBAL_SLOTS   USZRAM_CACHE_SLOTS
+#define GLOBAL_LAYOUTS 4u
+#define GLOBAL_SAMPLE  16u
+#define GLOBAL_RELEARN 4096u
+#define MAX_PG_RANGES  (2 * GLOBAL_SLOTS + 1)
+#define CACHE_PACKED_BITS 2
+
+#if GLOBAL_SLOTS < 1 || GLOBAL_SLOTS > FRONT_MAX_SLOTS \
+    || GLOBAL_SLOTS > BLK_PER_PG
+#  error USZRAM_CACHE_SLOTS must be at least 1, at most 64, and at most the \
+	 number of blocks per page
+#endif
+
+
+struct cache_data {
+	unsigned char layout;
+};
+
+static unsigned char global_front[GLOBAL_LAYOUTS][GLOBAL_SLOTS];
+static atomic_uint_least32_t global_refs[GLOBAL_LAYOUTS];
+static atomic_uchar global_current;
+static atomic_flag global_learning = ATOMIC_FLAG_INIT;
+static atomic_uint_least32_t global_counts[BLK_PER_PG], global_samples;
+static _Thread_local unsigned global_tick;
+
+static inline unsigned char global_slots(unsigned char layout)
+{
+	return layout ? GLOBAL_SLOTS : 0;
+}
+
+/* global_acquire() returns the newest layout after counting one more page as
+ * using it.
+ */
+static inline unsigned char global_acquire(void)
+{
+	for (;;) {
+		const unsigned char layout = global_current;
+		if (layout == 0)
+			return 0;
+		++global_refs[layout];
+		// Recheck, in case the layout was retired (and maybe about to
+		// be overwritten) before we counted ourselves
+		if (global_current == layout)
+			return layout;
+		--global_refs[layout];
+	}
+}
+
+static inline void global_release(unsigned char layout)
+{
+	if (layout)
+		--global_refs[layout];
+}
+
+/* global_relearn() chooses the hottest blocks and publishes them as a new
+ * layout if they differ from the newest one and a layout is free.
+ */
+static inline void global_relearn(void)
+{
+	if (atomic_flag_test_and_set(&global_learning))
+		return;
+
+	unsigned char next[GLOBAL_SLOTS], chosen = 0;
+	uint_least32_t counts[BLK_PER_PG];
+	for (uint_least16_t i = 0; i < BLK_PER_PG; ++i) {
+		counts[i] = global_counts[i];
+		// Increments racing with this are lost, which doesn't matter
+		global_counts[i] = counts[i] / 2;
+	}
+	while (chosen < GLOBAL_SLOTS) {
+		uint_least16_t best = BLK_PER_PG;
+		uint_least32_t best_count = 0;
+		for (uint_least16_t i = 0; i < BLK_PER_PG; ++i)
+			if (counts[i] > best_count) {
+				best = i;
+				best_count = counts[i];
+			}
+		if (best == BLK_PER_PG)
+			break;
+		counts[best] = 0;
+		next[chosen++] = best;
+	}
+	for (uint_least16_t blk = 0; chosen < GLOBAL_SLOTS; ++blk) {
+		unsigned char i = 0;
+		while (i < chosen && next[i] != blk)
+			++i;
+		if (i == chosen)
+			next[chosen++] = blk;
+	}
+
+	const unsigned char current = global_current;
+	if (current && !memcmp(global_front[current], next, sizeof next))
+		goto out;
+	for (unsigned char layout = 1; layout < GLOBAL_LAYOUTS; ++layout)
+		if (layout != current && global_refs[layout] == 0) {
+			memcpy(global_front[layout], next, sizeof next);
+			global_current = layout;
+			break;
+		}
+out:
+	atomic_flag_clear(&global_learning);
+}
+
+static inline void uncache_pg(const struct cache_data cache,
+			      char data[static PAGE_SIZE])
+{
+	front_uncache(global_slots(cache.layout), global_front[cache.layout],
+		      data);
+}
+
+static inline void cache_read(const struct cache_data cache, ByteRange byte,
+			      const char src[static PAGE_SIZE],
+			      char dest[static BLOCK_SIZE])
+{
+	front_read(global_slots(cache.layout), global_front[cache.layout],
+		   byte, src, dest);
+}
+
+static inline unsigned char get_pg_ranges(const struct cache_data cache,
+					  BlkRange blk,
+					  BlkRange ret[static MAX_PG_RANGES])
+{
+	return front_ranges(global_slots(cache.layout),
+			    global_front[cache.layout], blk, ret);
+}
+
+static inline size_type bytes_needed(const struct cache_data cache,
+				     const BlkRange blk)
+{
+	return front_bytes_needed(global_slots(cache.layout),
+				  global_front[cache.layout], blk);
+}
+
+static inline void cache_log_read(struct cache_data *cache, BlkRange blk)
+{
+	(void)cache;
+	if (++global_tick % GLOBAL_SAMPLE)
+		return;
+	for (uint_least16_t i = blk.offset; i < blk.offset + blk.count; ++i)
+		atomic_fetch_add_explicit(global_counts + i, 1,
+					  memory_order_relaxed);
+	if (++global_samples % GLOBAL_RELEARN == 0)
+		global_relearn();
+}
+
+static inline void cache_pg_copy(struct cache_data *cache,
+				 const char src[static PAGE_SIZE],
+				 char dest[static PAGE_SIZE])
+{
+	const unsigned char layout = global_acquire();
+	front_relayout(global_slots(cache->layout), global_front[cache->layout],
+		       global_slots(layout), global_front[layout], src, dest);
+	global_release(cache->layout);
+	cache->layout = layout;
+}
+
+static inline void cache_raw_pg_copy(struct cache_data *cache,
+				     const char src[static PAGE_SIZE],
+				     char dest[static PAGE_SIZE])
+{
+	const unsigned char layout = global_acquire();
+	front_relayout(0, NULL, global_slots(layout), global_front[layout],
+		       src, dest);
+	global_release(cache->layout);
+	cache->layout = layout;
+}
+
+static inline void cache_pg(struct cache_data *cache,
+			    char data[static PAGE_SIZE])
+{
+	char copy[PAGE_SIZE];
+	memcpy(copy, data, PAGE_SIZE);
+	cache_pg_copy(cache, copy, data);
+}
+
+static inline void cache_init(struct cache_data *cache)
+{
+	(void)cache;
+}
+
+static inline void cache_reset(struct cache_data *cache)
+{
+	global_release(cache->layout);
+	cache->layout = 0;
+}
+
+static inline void cache_exit(void)
+{
+	for (uint_least16_t i = 0; i < BLK_PER_PG; ++i)
+		global_counts[i] = 0;
+	for (unsigned char layout = 0; layout < GLOBAL_LAYOUTS; ++layout)
+		global_refs[layout] = 0;
+	global_samples = 0;
+	global_current = 0;
+}
+
+
+#endif // GLOBAL_CACHE_H
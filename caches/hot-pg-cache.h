@@ -0,0 +1,164 @@
+/* hot-pg-cache.h keeps a bounded set of fully decompressed pages that are read
+ * often, shared by all threads, so that reading them again is a copy instead of
+ * a decompression. Unlike the caching strategies in cache-api.h, which reorder
+ * blocks within each compressed page, it stores no per-page metadata and can be
+ * combined with any of them.
+ *
+ * The cache is set-associative: each page maps to one set of HOT_WAYS slots,
+ * chosen by hashing its address so that neighboring pages (which tend to be hot
+ * together) spread over different sets. Each set has its own lock, and slots
+ * are replaced with the CLOCK algorithm: a hit marks a slot referenced, and
+ * eviction skips (and unmarks) referenced slots.
+ *
+ * Admission is filtered by a doorkeeper bitmap as in TinyLFU: a page missing
+ * from the cache only sets its bit the first time, and is admitted the next
+ * time it misses while its bit is still set. The bitmap is cleared every
+ * HOT_SLOTS admissions, so one-off reads never displace hot pages.
+ *
+ * Callers must hold the uszram lock of a page, as a reader or writer, for
+ * hot_read() and hot_insert() and as a writer for hot_invalidate(). This way,
+ * the cached copy of a page can't go stale: writes invalidate it under the same
+ * lock that readers hold while copying from or inserting into the cache. The
+ * lock backend must be included before this file.
+ */
+
+#ifndef HOT_PG_CACHE_H
+#define HOT_PG_CACHE_H
+
+
+#include <string.h>
+#include <stdatomic.h>
+
+#include "../uszram-def.h"
+#include "../locks-api.h"
+
+
+#define HOT_WAYS  8u
+#define HOT_SLOTS (USZRAM_HOT_PG_BYTES / PAGE_SIZE)
+#define HOT_SETS  (HOT_SLOTS / HOT_WAYS)
+
+#if HOT_SETS == 0
+#  error USZRAM_HOT_PG_BYTES must be at least 8 pages
+#endif
+
+// Values of hot_set.ref[i]
+#define HOT_EMPTY 0u
+#define HOT_VALID 1u
+#define HOT_REFED 2u
+
+
+struct hot_set {
+	struct lock     lock;
+	uint_least32_t  pg_addr[HOT_WAYS];
+	atomic_uchar    ref[HOT_WAYS];
+	unsigned char   hand;
+};
+
+static struct hot_set hot_sets[HOT_SETS];
+static char hot_data[HOT_SETS][HOT_WAYS][PAGE_SIZE];
+static atomic_uint_least64_t hot_seen[(HOT_SLOTS - 1) / 8 + 1];
+static atomic_uint_least32_t hot_admits;
+
+static inline struct hot_set *hot_get_set(uint_least32_t pg_addr)
+{
+	return hot_sets + (uint_least32_t)(pg_addr * 2654435761u) % HOT_SETS;
+}
+
+static inline int hot_find(const struct hot_set *set, uint_least32_t pg_addr)
+{
+	for (unsigned char i = 0; i < HOT_WAYS; ++i)
+		if (set->ref[i] != HOT_EMPTY && set->pg_addr[i] == pg_addr)
+			return i;
+	return -1;
+}
+
+/* hot_admit() returns whether a page that missed the cache should be inserted,
+ * updating the doorkeeper bitmap.
+ */
+static inline _Bool hot_admit(uint_least32_t pg_addr)
+{
+	const uint_least64_t bits = sizeof hot_seen * 8,
+			     bit  = (pg_addr * 0x9e3779b97f4a7c15u >> 20) % bits,
+			     mask = (uint_least64_t)1 << bit % 64;
+	if (!(atomic_fetch_or(hot_seen + bit / 64, mask) & mask))
+		return 0;
+	if (++hot_admits % HOT_SLOTS == 0)
+		for (size_t i = 0; i < sizeof hot_seen / sizeof *hot_seen; ++i)
+			hot_seen[i] = 0;
+	return 1;
+}
+
+/* hot_read() copies the bytes specified by 'byte' of the page at pg_addr into
+ * dest if the page is cached. Returns whether it was.
+ */
+static inline _Bool hot_read(uint_least32_t pg_addr, ByteRange byte,
+			     char *dest)
+{
+	struct hot_set *set = hot_get_set(pg_addr);
+	lock_as_reader(&set->lock);
+	const int way = hot_find(set, pg_addr);
+	if (way >= 0) {
+		memcpy(dest, hot_data[set - hot_sets][way] + byte.offset,
+		       byte.count);
+		set->ref[way] = HOT_REFED;
+	}
+	unlock_as_reader(&set->lock);
+	return way >= 0;
+}
+
+/* hot_insert() offers the page at pg_addr, whose full contents in original
+ * order are in src, to the cache after a miss.
+ */
+static inline void hot_insert(uint_least32_t pg_addr,
+			      const char src[static PAGE_SIZE])
+{
+	if (!hot_admit(pg_addr))
+		return;
+	struct hot_set *set = hot_get_set(pg_addr);
+	lock_as_writer(&set->lock);
+	if (hot_find(set, pg_addr) < 0) {
+		while (set->ref[set->hand] == HOT_REFED) {
+			set->ref[set->hand] = HOT_VALID;
+			set->hand = (set->hand + 1) % HOT_WAYS;
+		}
+		memcpy(hot_data[set - hot_sets][set->hand], src, PAGE_SIZE);
+		set->pg_addr[set->hand] = pg_addr;
+		set->ref[set->hand] = HOT_VALID;
+		set->hand = (set->hand + 1) % HOT_WAYS;
+	}
+	unlock_as_writer(&set->lock);
+}
+
+/* hot_invalidate() removes the page at pg_addr from the cache, if present.
+ */
+static inline void hot_invalidate(uint_least32_t pg_addr)
+{
+	struct hot_set *set = hot_get_set(pg_addr);
+	lock_as_writer(&set->lock);
+	const int way = hot_find(set, pg_addr);
+	if (way >= 0)
+		set->ref[way] = HOT_EMPTY;
+	unlock_as_writer(&set->lock);
+}
+
+static inline void hot_init(void)
+{
+	for (uint_least64_t i = 0; i != HOT_SETS; ++i)
+		initialize_lock(&hot_sets[i].lock);
+}
+
+static inline void hot_exit(void)
+{
+	for (uint_least64_t i = 0; i != HOT_SETS; ++i) {
+		destroy_lock(&hot_sets[i].lock);
+		for (unsigned char j = 0; j < HOT_WAYS; ++j)
+			hot_sets[i].ref[j] = HOT_EMPTY;
+		hot_sets[i].hand = 0;
+	}
+	for (size_t i = 0; i < sizeof hot_seen / sizeof *hot_seen; ++i)
+		hot_seen[i] = 0;
+	hot_admits = 0;
+}
+
+
+#endif // HOT_PG_CACHE_H
@@ -257,7 +257,9 @@ static inline void cache_log_read(struct cache_data *cache, BlkRange blk)
 		cache->cand1count
 	}, cache_loc[256];
 	memset(cache_loc + blk.offset, 0, blk.count);
-	for (unsigned char i = 1; i < sizeof cached / sizeof *cached; ++i)
+	// Backwards so that a block in both next and cand (like the initial
+	// zeros) is found in next, as with LOG_READ1
+	for (unsigned char i = sizeof cached / sizeof *cached - 1; i > 0; --i)
 		if (cached[i] >= blk.offset)
 			cache_loc[cached[i]] = i;
 	for (unsigned char i = blk.offset; i < blk.offset + blk.count; ++i) {
@@ -355,6 +357,15 @@ static inline void cache_pg_copy(struct cache_data *cache,
 	cache->cur1 = cache->next1;
 }
 
+static inline void cache_raw_pg_copy(struct cache_data *cache,
+				     const char src[static PAGE_SIZE],
+				     char dest[static PAGE_SIZE])
+{
+	cache->cur0 = 0;
+	cache->cur1 = 1;
+	cache_pg_copy(cache, src, dest);
+}
+
 static inline void cache_pg(struct cache_data *cache,
 			    char data[static PAGE_SIZE])
 {
@@ -375,5 +386,9 @@ static inline void cache_reset(struct cache_data *cache)
 	cache_init(cache);
 }
 
+static inline void cache_exit(void)
+{
+}
+
 
 #endif // LIST2_CACHE_H
@@ -0,0 +1,201 @@
+/* listn-cache.h generalizes list2-cache.h to keep LISTN_SLOTS (set by
+ * USZRAM_CACHE_SLOTS) of the most frequently read blocks at the beginning of
+ * each page, which pays off for large pages with many hot blocks.
+ *
+ * struct cache_data has three parts. cur lists the blocks that are currently
+ * cached: cur[i] is stored at block i of the (out-of-order) page, and the rest
+ * of the blocks follow in their original order (see front-blocks.h). When
+ * uszram starts up, cur[i] is i, which represents that the page is in its
+ * natural order.
+ *
+ * The other two parts form a Space-Saving frequency sketch of recent reads:
+ * tracked lists LISTN_TRACKED blocks and counts has a 4-bit read counter for
+ * each of them, packed two to a byte. When a tracked block is read, its counter
+ * is incremented. When an untracked block is read, it replaces the tracked
+ * block with the smallest counter, inheriting half of that counter plus one.
+ * Inheriting the whole counter, as in plain Space-Saving, guarantees that a
+ * block read often enough is tracked no matter how many other blocks are read
+ * once, but it lets newcomers overtake the hot blocks too easily; halving keeps
+ * most of the guarantee while ranking the hot blocks better.
+ * When a counter reaches LISTN_MAX_COUNT, all of them are halved so that the
+ * sketch follows changes in popularity.
+ *
+ * Whenever the page is compressed, the (up to) LISTN_SLOTS tracked blocks with
+ * the highest nonzero counters become the new cur, most frequent first. Any
+ * remaining slots get the lowest-numbered blocks not chosen, which keeps an
+ * idle page close to its natural order.
+ */
+
+#ifndef LISTN_CACHE_H
+#define LISTN_CACHE_H
+
+
+#include <string.h>
+
+#include "../cache-api.h"
+#include "front-blocks.h"
+
+
+#define LISTN_SLOTS     USZRAM_CACHE_SLOTS
+#define LISTN_TRACKED   (2 * LISTN_SLOTS)
+#define LISTN_MAX_COUNT 15u
+#define MAX_PG_RANGES   (2 * LISTN_SLOTS + 1)
+
+#if LISTN_SLOTS < 1 || LISTN_SLOTS > FRONT_MAX_SLOTS \
+    || LISTN_SLOTS > BLK_PER_PG
+#  error USZRAM_CACHE_SLOTS must be at least 1, at most 64, and at most the \
+	 number of blocks per page
+#endif
+
+
+struct cache_data {
+	unsigned char  cur[LISTN_SLOTS],
+		       tracked[LISTN_TRACKED],
+		       counts[LISTN_TRACKED / 2];
+};
+
+static inline unsigned char listn_count(const struct cache_data *cache,
+					unsigned char i)
+{
+	return cache->counts[i / 2] >> i % 2 * 4 & 0xf;
+}
+
+static inline void listn_set_count(struct cache_data *cache, unsigned char i,
+				   unsigned char count)
+{
+	const unsigned char shift = i % 2 * 4;
+	cache->counts[i / 2] = (cache->counts[i / 2] & ~(0xf << shift))
+			       | count << shift;
+}
+
+static inline void uncache_pg(const struct cache_data cache,
+			      char data[static PAGE_SIZE])
+{
+	front_uncache(LISTN_SLOTS, cache.cur, data);
+}
+
+static inline void cache_read(const struct cache_data cache, ByteRange byte,
+			      const char src[static PAGE_SIZE],
+			      char dest[static BLOCK_SIZE])
+{
+	front_read(LISTN_SLOTS, cache.cur, byte, src, dest);
+}
+
+static inline unsigned char get_pg_ranges(const struct cache_data cache,
+					  BlkRange blk,
+					  BlkRange ret[static MAX_PG_RANGES])
+{
+	return front_ranges(LISTN_SLOTS, cache.cur, blk, ret);
+}
+
+static inline size_type bytes_needed(const struct cache_data cache,
+				     const BlkRange blk)
+{
+	return front_bytes_needed(LISTN_SLOTS, cache.cur, blk);
+}
+
+static inline void cache_log_read(struct cache_data *cache, BlkRange blk)
+{
+	const uint_least16_t end = blk.offset + blk.count;
+	for (; blk.offset < end; ++blk.offset) {
+		unsigned char hit = LISTN_TRACKED, min = 0;
+		for (unsigned char i = 0; i < LISTN_TRACKED; ++i) {
+			if (cache->tracked[i] == blk.offset) {
+				hit = i;
+				break;
+			}
+			if (listn_count(cache, i) < listn_count(cache, min))
+				min = i;
+		}
+		if (hit == LISTN_TRACKED) {
+			hit = min;
+			cache->tracked[hit] = blk.offset;
+			listn_set_count(cache, hit,
+					listn_count(cache, hit) / 2);
+		}
+		const unsigned char count = listn_count(cache, hit) + 1;
+		listn_set_count(cache, hit, count);
+		if (count == LISTN_MAX_COUNT)
+			for (unsigned char i = 0; i < LISTN_TRACKED; ++i)
+				listn_set_count(cache, i,
+						listn_count(cache, i) / 2);
+	}
+}
+
+/* listn_choose() writes to cur the blocks that should be cached next, as
+ * described at the top of this file.
+ */
+static inline void listn_choose(const struct cache_data *cache,
+				unsigned char cur[static LISTN_SLOTS])
+{
+	unsigned char chosen = 0, taken[LISTN_TRACKED] = {0};
+	while (chosen < LISTN_SLOTS) {
+		unsigned char best = LISTN_TRACKED, best_count = 0;
+		for (unsigned char i = 0; i < LISTN_TRACKED; ++i)
+			if (!taken[i] && listn_count(cache, i) > best_count) {
+				best = i;
+				best_count = listn_count(cache, i);
+			}
+		if (best == LISTN_TRACKED)
+			break;
+		taken[best] = 1;
+		// Racing readers may have left a block tracked twice
+		unsigned char i = 0;
+		while (i < chosen && cur[i] != cache->tracked[best])
+			++i;
+		if (i == chosen)
+			cur[chosen++] = cache->tracked[best];
+	}
+	for (uint_least16_t blk = 0; chosen < LISTN_SLOTS; ++blk) {
+		unsigned char i = 0;
+		while (i < chosen && cur[i] != blk)
+			++i;
+		if (i == chosen)
+			cur[chosen++] = blk;
+	}
+}
+
+static inline void cache_pg_copy(struct cache_data *cache,
+				 const char src[static PAGE_SIZE],
+				 char dest[static PAGE_SIZE])
+{
+	unsigned char next[LISTN_SLOTS];
+	listn_choose(cache, next);
+	front_relayout(LISTN_SLOTS, cache->cur, LISTN_SLOTS, next, src, dest);
+	memcpy(cache->cur, next, sizeof next);
+}
+
+static inline void cache_init(struct cache_data *cache)
+{
+	for (unsigned char i = 0; i < LISTN_SLOTS; ++i)
+		cache->cur[i] = i;
+}
+
+static inline void cache_raw_pg_copy(struct cache_data *cache,
+				     const char src[static PAGE_SIZE],
+				     char dest[static PAGE_SIZE])
+{
+	cache_init(cache);
+	cache_pg_copy(cache, src, dest);
+}
+
+static inline void cache_pg(struct cache_data *cache,
+			    char data[static PAGE_SIZE])
+{
+	char copy[PAGE_SIZE];
+	memcpy(copy, data, PAGE_SIZE);
+	cache_pg_copy(cache, copy, data);
+}
+
+static inline void cache_reset(struct cache_data *cache)
+{
+	memset(cache, 0, sizeof *cache);
+	cache_init(cache);
+}
+
+static inline void cache_exit(void)
+{
+}
+
+
+#endif // LISTN_CACHE_H
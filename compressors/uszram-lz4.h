@@ -17,7 +17,7 @@ static inline int decompress(const struct page *pg, size_type bytes,
 			     char dest[static PAGE_SIZE])
 {
 	const int ret = LZ4_decompress_safe_partial(
-		pg->data, dest, get_size(pg), bytes, PAGE_SIZE);
+		pg_data(pg), dest, get_size(pg), bytes, PAGE_SIZE);
 	return ret < 0 ? ret : 0;
 }
 
@@ -16,24 +16,24 @@ static page_opts pg_options = {
 
 static inline _Bool is_huge(const struct page *pg)
 {
-	return pg->compr_data.size >> SIZE_SHIFT;
+	return pg_compr(pg).size >> SIZE_SHIFT;
 }
 
 static inline size_type get_size(const struct page *pg)
 {
-	return is_huge(pg) ? PAGE_SIZE : zapi_page_size((BYTE *)pg->data);
+	return is_huge(pg) ? PAGE_SIZE : zapi_page_size((BYTE *)pg_data(pg));
 }
 
 static inline size_type get_size_primary(const struct page *pg)
 {
-	return is_huge(pg) ? PAGE_SIZE : pg->compr_data.size;
+	return is_huge(pg) ? PAGE_SIZE : pg_compr(pg).size;
 }
 
 static inline size_type free_reachable(const struct page *pg)
 {
-	const size_type old_size = zapi_page_size((BYTE *)pg->data);
-	zapi_free_page((BYTE *)pg->data);
-	return old_size - zapi_page_size((BYTE *)pg->data);
+	const size_type old_size = zapi_page_size((BYTE *)pg_data(pg));
+	zapi_free_page((BYTE *)pg_data(pg));
+	return old_size - zapi_page_size((BYTE *)pg_data(pg));
 }
 
 static inline size_type compress(const char src[static PAGE_SIZE],
@@ -46,7 +46,7 @@ static inline size_type compress(const char src[static PAGE_SIZE],
 static inline int decompress(const struct page *pg, size_type bytes,
 			     char dest[static PAGE_SIZE])
 {
-	return -!zapi_decompress_page((BYTE *)pg->data, (BYTE *)dest,
+	return -!zapi_decompress_page((BYTE *)pg_data(pg), (BYTE *)dest,
 				      &pg_options, bytes / BLOCK_SIZE);
 }
 
@@ -54,19 +54,21 @@ static inline void write_compressed(struct page *pg, size_type bytes,
 				    const char *src)
 {
 	if (src)
-		memcpy(pg->data, src, bytes);
-	pg->compr_data.size = bytes >> USZRAM_PAGE_SHIFT
-			      ? 1u << SIZE_SHIFT
-			      : bytes;
+		memcpy(pg_data(pg), src, bytes);
+	set_pg_compr(pg, (struct compr_data){
+		.size = bytes >> USZRAM_PAGE_SHIFT ? 1u << SIZE_SHIFT : bytes,
+	});
 }
 
 static inline _Bool needs_recompress(struct page *pg, size_type blocks)
 {
 	const unsigned char mask = (1 << 6) - 1;
-	const size_type updates = (pg->compr_data.size & mask) + blocks;
+	struct compr_data compr = pg_compr(pg);
+	const size_type updates = (compr.size & mask) + blocks;
 	if (updates >= USZRAM_HUGE_WAIT)
 		return 1;
-	pg->compr_data.size += blocks;
+	compr.size += blocks;
+	set_pg_compr(pg, compr);
 	return 0;
 }
 
@@ -96,7 +98,7 @@ static inline int read_modify(const struct page *pg,
 		}
 		for (uint_least16_t j = 0; j < ranges[i].count; ++j) {
 			ret = zapi_update_block(
-				(BYTE *)new_data, (BYTE *)pg->data,
+				(BYTE *)new_data, (BYTE *)pg_data(pg),
 				ranges[i].offset + j, &pg_options,
 				(BYTE *)raw_pg, 512);
 			new_data += BLOCK_SIZE;
@@ -144,7 +146,7 @@ static inline int read_delete(const struct page *pg,
 	for (unsigned char i = 0; i < range_count; ++i)
 		memset(raw_pg + ranges[i].offset * BLOCK_SIZE, 0,
 		       ranges[i].count * BLOCK_SIZE);
-	return 1;
+	return raw_pg[0] || memcmp(raw_pg, raw_pg + 1, PAGE_SIZE - 1);
 }
 
 
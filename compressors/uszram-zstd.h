@@ -18,7 +18,7 @@ static inline int decompress(const struct page *pg, size_type bytes,
 			     char dest[static PAGE_SIZE])
 {
 	(void)bytes;
-	const size_t ret = ZSTD_decompress(dest, PAGE_SIZE, pg->data,
+	const size_t ret = ZSTD_decompress(dest, PAGE_SIZE, pg_data(pg),
 					   get_size(pg));
 	return ZSTD_isError(ret) ? -1 : 0;
 }
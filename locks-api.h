@@ -11,5 +11,11 @@ static inline int lock_as_writer(struct lock *lock);
 static inline int unlock_as_reader(struct lock *lock);
 static inline int unlock_as_writer(struct lock *lock);
 
+/* trylock_as_reader() and trylock_as_writer() are like lock_as_reader() and
+ * lock_as_writer() but return nonzero instead of waiting if the lock is taken.
+ */
+static inline int trylock_as_reader(struct lock *lock);
+static inline int trylock_as_writer(struct lock *lock);
+
 
 #endif // LOCKS_API_H
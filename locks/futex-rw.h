@@ -0,0 +1,148 @@
+/* futex-rw.h implements the readers-writer lock behind uszram-futex-rw.h and
+ * uszram-bravo.h in a single 32-bit word, a tenth the size of pthread_rwlock_t.
+ * The word has a writer bit, a "writer wanted" bit that keeps new readers out
+ * so that writers aren't starved, a waiters bit, and a 29-bit reader count, so
+ * an uncontended lock or unlock is a single atomic operation.
+ *
+ * Threads that can't take the lock spin for a while (see futex_spin_limit()),
+ * then set the waiters bit and sleep (see futex.h). Unlocking wakes all
+ * sleepers if the bit was set.
+ */
+
+#ifndef FUTEX_RW_H
+#define FUTEX_RW_H
+
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "futex.h"
+
+
+#define FUTEX_RW_WRITER  ((uint_least32_t)1 << 31)
+#define FUTEX_RW_WANTED  ((uint_least32_t)1 << 30)
+#define FUTEX_RW_WAITERS ((uint_least32_t)1 << 29)
+#define FUTEX_RW_READERS (FUTEX_RW_WAITERS - 1)
+
+
+struct futex_rw {
+	atomic_uint_least32_t word;
+};
+
+static inline uint_least32_t futex_rw_load(struct futex_rw *lock)
+{
+	return atomic_load_explicit(&lock->word, memory_order_relaxed);
+}
+
+static inline _Bool futex_rw_cas(struct futex_rw *lock,
+				 uint_least32_t word, uint_least32_t new)
+{
+	return atomic_compare_exchange_weak_explicit(&lock->word, &word, new,
+						     memory_order_acquire,
+						     memory_order_relaxed);
+}
+
+/* futex_rw_sleep() sleeps while the word is 'word', which is a value that the
+ * caller couldn't take the lock in, after setting the waiters bit along with
+ * 'bits'.
+ */
+static inline void futex_rw_sleep(struct futex_rw *lock,
+				  uint_least32_t word, uint_least32_t bits)
+{
+	bits |= FUTEX_RW_WAITERS;
+	if ((word & bits) != bits
+	    && !atomic_compare_exchange_strong(&lock->word, &word, word | bits))
+		return;
+	futex_wait(&lock->word, word | bits);
+}
+
+static inline void futex_rw_lock_reader(struct futex_rw *lock)
+{
+	const unsigned limit = futex_spin_limit();
+	for (unsigned spins = 0;; ++spins) {
+		uint_least32_t word = futex_rw_load(lock);
+		if (!(word & (FUTEX_RW_WRITER | FUTEX_RW_WANTED))) {
+			if (futex_rw_cas(lock, word, word + 1)) {
+				futex_spun(spins, limit);
+				return;
+			}
+		} else if (spins < limit) {
+			futex_pause();
+		} else {
+			futex_rw_sleep(lock, word, 0);
+			spins = limit;
+		}
+	}
+}
+
+static inline void futex_rw_lock_writer(struct futex_rw *lock)
+{
+	const unsigned limit = futex_spin_limit();
+	for (unsigned spins = 0;; ++spins) {
+		uint_least32_t word = futex_rw_load(lock);
+		if (!(word & (FUTEX_RW_WRITER | FUTEX_RW_READERS))) {
+			// Clear the wanted bit; other waiting writers set it
+			// again when they wake up
+			const uint_least32_t new = (word & ~FUTEX_RW_WANTED)
+						   | FUTEX_RW_WRITER;
+			if (futex_rw_cas(lock, word, new)) {
+				futex_spun(spins, limit);
+				return;
+			}
+		} else if (spins < limit) {
+			futex_pause();
+		} else {
+			futex_rw_sleep(lock, word, FUTEX_RW_WANTED);
+			spins = limit;
+		}
+	}
+}
+
+/* futex_rw_trylock_reader() and futex_rw_trylock_writer() take the lock if
+ * they can do so without waiting and return whether they did.
+ */
+static inline _Bool futex_rw_trylock_reader(struct futex_rw *lock)
+{
+	for (;;) {
+		const uint_least32_t word = futex_rw_load(lock);
+		if (word & (FUTEX_RW_WRITER | FUTEX_RW_WANTED))
+			return 0;
+		if (futex_rw_cas(lock, word, word + 1))
+			return 1;
+	}
+}
+
+static inline _Bool futex_rw_trylock_writer(struct futex_rw *lock)
+{
+	for (;;) {
+		const uint_least32_t word = futex_rw_load(lock);
+		if (word & (FUTEX_RW_WRITER | FUTEX_RW_READERS))
+			return 0;
+		const uint_least32_t new = (word & ~FUTEX_RW_WANTED)
+					   | FUTEX_RW_WRITER;
+		if (futex_rw_cas(lock, word, new))
+			return 1;
+	}
+}
+
+static inline void futex_rw_unlock_reader(struct futex_rw *lock)
+{
+	const uint_least32_t word = atomic_fetch_sub_explicit(
+		&lock->word, 1, memory_order_release);
+	if ((word & FUTEX_RW_READERS) == 1 && word & FUTEX_RW_WAITERS) {
+		atomic_fetch_and(&lock->word, ~FUTEX_RW_WAITERS);
+		futex_wake(&lock->word);
+	}
+}
+
+static inline void futex_rw_unlock_writer(struct futex_rw *lock)
+{
+	const uint_least32_t word = atomic_fetch_and_explicit(
+		&lock->word, ~(FUTEX_RW_WRITER | FUTEX_RW_WAITERS),
+		memory_order_release);
+	if (word & FUTEX_RW_WAITERS)
+		futex_wake(&lock->word);
+}
+
+
+#endif // FUTEX_RW_H
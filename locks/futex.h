@@ -0,0 +1,110 @@
+/* futex.h lets the locks built on a single 32-bit atomic word sleep while it
+ * holds a given value and wake threads sleeping on it. On Linux, these are the
+ * futex system calls; elsewhere, futex_wait() just yields the processor, so
+ * waiting degrades to spinning with yields.
+ */
+
+#ifndef FUTEX_H
+#define FUTEX_H
+
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#  include <limits.h>
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#else
+#  include <sched.h>
+#endif
+
+
+/* A thread retries a lock between FUTEX_MIN_SPINS and FUTEX_MAX_SPINS times
+ * before sleeping. A critical section is typically a memcpy or a decompression
+ * of one page, so a short spin usually outlasts it without a system call.
+ */
+#define FUTEX_MIN_SPINS 16u
+#define FUTEX_MAX_SPINS 1024u
+
+/* futex_spin_avg is a moving average, in eighths, of the spins it took this
+ * thread to take contended locks.
+ */
+static _Thread_local unsigned futex_spin_avg = 8 * FUTEX_MIN_SPINS;
+
+/* futex_single_cpu is 1 if only one processor is online, in which case the
+ * holder of a lock can't run while a thread spins on it, 0 if more are, or -1
+ * until checked. Threads may check concurrently, but they all store the same
+ * value, so relaxed accesses suffice.
+ */
+static atomic_int futex_single_cpu = -1;
+
+/* futex_spin_limit() returns how many times to retry a lock before sleeping:
+ * twice the recent average, so that spinning adapts to how long locks are
+ * held, or 0 on a single processor.
+ */
+static inline unsigned futex_spin_limit(void)
+{
+	int single = atomic_load_explicit(&futex_single_cpu,
+					  memory_order_relaxed);
+	if (single < 0) {
+		single = sysconf(_SC_NPROCESSORS_ONLN) == 1;
+		atomic_store_explicit(&futex_single_cpu, single,
+				      memory_order_relaxed);
+	}
+	if (single)
+		return 0;
+	const unsigned limit = futex_spin_avg / 4;
+	if (limit < FUTEX_MIN_SPINS)
+		return FUTEX_MIN_SPINS;
+	return limit < FUTEX_MAX_SPINS ? limit : FUTEX_MAX_SPINS;
+}
+
+/* futex_spun() updates the average after a lock was taken on retry number
+ * 'spins', which is greater than the limit if the thread slept. Sleeping counts
+ * as 0 spins, since the spinning was wasted.
+ */
+static inline void futex_spun(unsigned spins, unsigned limit)
+{
+	if (spins == 0)
+		return;
+	const int target = spins > limit ? 0 : 8 * (int)spins;
+	futex_spin_avg += (target - (int)futex_spin_avg) / 8;
+}
+
+static inline void futex_pause(void)
+{
+#if defined __x86_64__ || defined __i386__
+	__builtin_ia32_pause();
+#elif defined __aarch64__
+	__asm__ __volatile__("yield");
+#endif
+}
+
+/* futex_wait() sleeps until woken by futex_wake() if *word is val. It may also
+ * return spuriously.
+ */
+static inline void futex_wait(atomic_uint_least32_t *word, uint_least32_t val)
+{
+#ifdef __linux__
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+	(void)word, (void)val;
+	sched_yield();
+#endif
+}
+
+/* futex_wake() wakes all threads sleeping in futex_wait() on word.
+ */
+static inline void futex_wake(atomic_uint_least32_t *word)
+{
+#ifdef __linux__
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+	(void)word;
+#endif
+}
+
+
+#endif // FUTEX_H
@@ -0,0 +1,224 @@
+/* lock-partition.h implements USZRAM_PARTITIONS. The lock stripes are split
+ * into USZRAM_PARTITIONS partitions of consecutive stripes, and a thread can
+ * own a partition (see uszram_own()). Only its owner ever touches the pages of
+ * an owned partition, so the owner can skip their locks: included after the
+ * lock backend (and lock-profile.h), this file redefines lock_as_reader(),
+ * lock_as_writer(), their trylock_*() counterparts, and unlock_as_reader() and
+ * unlock_as_writer() as macros that do nothing for the locks of the calling
+ * thread's own partition. part_of(), defined by uszram.c, maps a lock to its
+ * partition. Code included before this file, like the hot page cache, still
+ * takes its locks.
+ *
+ * Other threads forward their requests for an owned partition to its owner
+ * instead. A request is a struct part_msg on the stack of the requester, which
+ * pushes it onto the partition's inbox, a lock-free stack, and waits for the
+ * owner to run it. The owner runs the requests in its inbox whenever it calls
+ * into the store and in uszram_serve(), and a requester that owns a partition
+ * serves its own inbox while it waits, so owners forwarding to each other
+ * can't deadlock. Pages of partitions that no one owns are locked as usual.
+ */
+
+#ifndef LOCK_PARTITION_H
+#define LOCK_PARTITION_H
+
+
+#include <sched.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "../uszram-def.h"
+#include "../locks-api.h"
+
+#if USZRAM_DYNAMIC_LOCKS
+#  error USZRAM_PARTITIONS cannot be used with USZRAM_DYNAMIC_LOCKS, whose \
+locks are shared by stripes of different partitions
+#endif
+
+
+#define PART_LOCKS ((LOCK_COUNT - 1) / USZRAM_PARTITIONS + 1)
+#define PART_PAGES ((uint_least64_t)PART_LOCKS * PG_PER_LOCK)
+#define PART_NONE  UINT_MAX
+
+
+struct part_msg {
+	struct part_msg  *next;
+	int             (*fn)(const struct part_msg *msg);
+	uint_least32_t    addr,		// Of the first page or block
+			  count;
+	char             *out;
+	const char       *in,
+			 *orig;
+	void             *arg;
+	int               ret;
+	atomic_bool       done;
+};
+
+struct partition {
+	_Alignas(64)
+	atomic_uintptr_t           owner;	// &part_token of the owner or 0
+	struct part_msg *_Atomic   inbox;
+};
+
+static struct partition parts[USZRAM_PARTITIONS];
+
+// Only the address of part_token matters; it tells threads apart
+static _Thread_local char part_token;
+static _Thread_local unsigned part_me = PART_NONE;
+
+static unsigned part_of(const struct lock *lock);
+
+static inline _Bool part_owns(unsigned part)
+{
+	return atomic_load_explicit(&parts[part].owner, memory_order_relaxed)
+	       == (uintptr_t)&part_token;
+}
+
+/* part_mine() returns the partition of the calling thread, or PART_NONE.
+ */
+static inline unsigned part_mine(void)
+{
+	return part_me != PART_NONE && part_owns(part_me) ? part_me : PART_NONE;
+}
+
+static inline int part_lock(struct lock *lock, _Bool writer)
+{
+	if (part_owns(part_of(lock)))
+		return 0;
+	return writer ? lock_as_writer(lock) : lock_as_reader(lock);
+}
+
+static inline int part_trylock(struct lock *lock, _Bool writer)
+{
+	if (part_owns(part_of(lock)))
+		return 0;
+	return writer ? trylock_as_writer(lock) : trylock_as_reader(lock);
+}
+
+static inline int part_unlock(struct lock *lock, _Bool writer)
+{
+	if (part_owns(part_of(lock)))
+		return 0;
+	return writer ? unlock_as_writer(lock) : unlock_as_reader(lock);
+}
+
+#undef lock_as_reader
+#undef lock_as_writer
+#undef trylock_as_reader
+#undef trylock_as_writer
+#undef unlock_as_reader
+#undef unlock_as_writer
+#define lock_as_reader(lock)    part_lock   (lock, 0)
+#define lock_as_writer(lock)    part_lock   (lock, 1)
+#define trylock_as_reader(lock) part_trylock(lock, 0)
+#define trylock_as_writer(lock) part_trylock(lock, 1)
+#define unlock_as_reader(lock)  part_unlock (lock, 0)
+#define unlock_as_writer(lock)  part_unlock (lock, 1)
+
+/* part_serve() runs the requests in the inbox of partition 'part', which the
+ * calling thread owns, and returns how many there were.
+ */
+static int part_serve(unsigned part)
+{
+	if (atomic_load_explicit(&parts[part].inbox, memory_order_relaxed)
+	    == NULL)
+		return 0;
+	struct part_msg *msg = atomic_exchange_explicit(&parts[part].inbox,
+							NULL,
+							memory_order_acquire);
+	int served = 0;
+	while (msg) {
+		// The requester's stack frame is gone once it sees 'done'
+		struct part_msg *const next = msg->next;
+		msg->ret = msg->fn(msg);
+		atomic_store_explicit(&msg->done, 1, memory_order_release);
+		msg = next;
+		++served;
+	}
+	return served;
+}
+
+/* part_forward() has the owner of partition 'part' run msg and returns the
+ * result.
+ */
+static int part_forward(unsigned part, struct part_msg *msg)
+{
+	atomic_init(&msg->done, 0);
+	msg->next = atomic_load_explicit(&parts[part].inbox,
+					 memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(&parts[part].inbox,
+						      &msg->next, msg,
+						      memory_order_release,
+						      memory_order_relaxed))
+		;
+	while (!atomic_load_explicit(&msg->done, memory_order_acquire)) {
+		const unsigned mine = part_mine();
+		if (mine == PART_NONE || part_serve(mine) == 0)
+			sched_yield();
+	}
+	return msg->ret;
+}
+
+/* part_enter() returns whether the calling thread can run an operation on
+ * 'count' pages or blocks (if blk) starting at addr itself: whether they are
+ * all in one partition, which it owns or no one owns. If it owns it, its inbox
+ * is served first.
+ */
+static inline _Bool part_enter(_Bool blk, uint_least32_t addr,
+			       uint_least32_t count)
+{
+	const uint_least64_t per = blk ? PART_PAGES * BLK_PER_PG : PART_PAGES;
+	const unsigned part = addr / per;
+	if (part != ((uint_least64_t)addr + count - 1) / per)
+		return 0;
+	const uintptr_t owner = atomic_load_explicit(&parts[part].owner,
+						     memory_order_relaxed);
+	if (owner == (uintptr_t)&part_token)
+		part_serve(part);
+	return owner == 0 || owner == (uintptr_t)&part_token;
+}
+
+/* part_route() runs msg->fn on the part of its range in each partition, or has
+ * the owner of the partition run it, and returns the first nonzero result.
+ * 'unit' is the size of a page or block in msg's buffers. Each part is done in
+ * turn, so an operation spanning partitions isn't atomic as a whole.
+ */
+static int part_route(_Bool blk, size_type unit, struct part_msg msg)
+{
+	const uint_least64_t per = blk ? PART_PAGES * BLK_PER_PG : PART_PAGES,
+			     end = (uint_least64_t)msg.addr + msg.count;
+	int ret = 0;
+	for (uint_least64_t addr = msg.addr; addr != end;) {
+		const unsigned part = addr / per;
+		const uint_least64_t next = end - addr < per - addr % per
+					    ? end : (part + 1) * per;
+		struct part_msg chunk = msg;
+		chunk.addr = addr;
+		chunk.count = next - addr;
+		const uintptr_t owner = atomic_load_explicit(
+			&parts[part].owner, memory_order_relaxed);
+		const int r = owner == 0 || owner == (uintptr_t)&part_token
+			      ? msg.fn(&chunk) : part_forward(part, &chunk);
+		if (ret == 0)
+			ret = r;
+		if (msg.out)
+			msg.out += (next - addr) * unit;
+		if (msg.in)
+			msg.in += (next - addr) * unit;
+		if (msg.orig)
+			msg.orig += (next - addr) * unit;
+		addr = next;
+	}
+	return ret;
+}
+
+static void part_clear(void)
+{
+	for (unsigned i = 0; i != USZRAM_PARTITIONS; ++i) {
+		parts[i].owner = 0;
+		parts[i].inbox = NULL;
+	}
+}
+
+
+#endif // LOCK_PARTITION_H
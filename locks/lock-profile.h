@@ -0,0 +1,123 @@
+/* lock-profile.h implements USZRAM_LOCK_PROFILE. Included after the lock
+ * backend, it redefines lock_as_reader(), lock_as_writer(), their trylock_*()
+ * counterparts, and unlock_as_reader() and unlock_as_writer() as macros that
+ * keep a profile of each lock around the backend's functions, so the code
+ * taking the locks stays the same. Code included before this file, like the
+ * hot page cache, uses the backend directly and isn't profiled, and so do calls
+ * like (lock_as_reader)(lock), which the statistics snapshot makes so that its
+ * sweep over every lock doesn't swamp the profile. prof_index(),
+ * defined by uszram.c, maps a lock to its profile: that of its lock stripe,
+ * or with USZRAM_DYNAMIC_LOCKS, that of its index in the lock table.
+ *
+ * A lock is tried first, and if that fails, the acquisition counts as contended
+ * and the time until the lock is taken as waiting. Hold time is counted by
+ * subtracting the time from hold_ns when the lock is taken and adding it back
+ * when it's released, which needs no state per holder but leaves hold_ns
+ * meaningless while the lock is held. Readers holding a lock together each
+ * count. Every acquisition reads the clock twice, so profiling slows the store
+ * down somewhat.
+ */
+
+#ifndef LOCK_PROFILE_H
+#define LOCK_PROFILE_H
+
+
+#include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "../uszram-def.h"
+#include "../locks-api.h"
+
+
+// The largest lock table has at least 64 locks and fewer than twice as many
+// locks as stripes; see lktbl_max_bits()
+#if USZRAM_DYNAMIC_LOCKS
+#  define PROF_SLOTS (LOCK_COUNT <= 64 ? 64 : 2 * LOCK_COUNT)
+#else
+#  define PROF_SLOTS LOCK_COUNT
+#endif
+
+
+struct lock_prof {
+	atomic_uint_least64_t  acquisitions,
+			       contended,
+			       wait_ns,
+			       hold_ns;
+};
+
+static struct lock_prof prof_table[PROF_SLOTS];
+
+static uint_least32_t prof_index(const struct lock *lock);
+
+static inline uint_least64_t prof_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint_least64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* prof_acquired() is called after taking 'lock', having started to wait for it
+ * at 'start' if 'contended'.
+ */
+static inline void prof_acquired(struct lock *lock, _Bool contended,
+				 uint_least64_t start)
+{
+	struct lock_prof *const prof = prof_table + prof_index(lock);
+	const uint_least64_t now = prof_now();
+	atomic_fetch_add_explicit(&prof->acquisitions, 1, memory_order_relaxed);
+	if (contended) {
+		atomic_fetch_add_explicit(&prof->contended, 1,
+					  memory_order_relaxed);
+		atomic_fetch_add_explicit(&prof->wait_ns, now - start,
+					  memory_order_relaxed);
+	}
+	atomic_fetch_sub_explicit(&prof->hold_ns, now, memory_order_relaxed);
+}
+
+static inline int prof_trylock(struct lock *lock, _Bool writer)
+{
+	const int ret = writer ? (trylock_as_writer)(lock)
+			       : (trylock_as_reader)(lock);
+	if (ret == 0)
+		prof_acquired(lock, 0, 0);
+	return ret;
+}
+
+static inline int prof_lock(struct lock *lock, _Bool writer)
+{
+	if (prof_trylock(lock, writer) == 0)
+		return 0;
+	const uint_least64_t start = prof_now();
+	const int ret = writer ? (lock_as_writer)(lock)
+			       : (lock_as_reader)(lock);
+	prof_acquired(lock, 1, start);
+	return ret;
+}
+
+static inline int prof_unlock(struct lock *lock, _Bool writer)
+{
+	atomic_fetch_add_explicit(&prof_table[prof_index(lock)].hold_ns,
+				  prof_now(), memory_order_relaxed);
+	return writer ? (unlock_as_writer)(lock) : (unlock_as_reader)(lock);
+}
+
+#define lock_as_reader(lock)    prof_lock   (lock, 0)
+#define lock_as_writer(lock)    prof_lock   (lock, 1)
+#define trylock_as_reader(lock) prof_trylock(lock, 0)
+#define trylock_as_writer(lock) prof_trylock(lock, 1)
+#define unlock_as_reader(lock)  prof_unlock (lock, 0)
+#define unlock_as_writer(lock)  prof_unlock (lock, 1)
+
+static void prof_clear(void)
+{
+	for (uint_least64_t i = 0; i != PROF_SLOTS; ++i) {
+		prof_table[i].acquisitions = 0;
+		prof_table[i].contended = 0;
+		prof_table[i].wait_ns = 0;
+		prof_table[i].hold_ns = 0;
+	}
+}
+
+
+#endif // LOCK_PROFILE_H
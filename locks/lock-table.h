@@ -0,0 +1,244 @@
+/* lock-table.h implements the resizable lock table of USZRAM_DYNAMIC_LOCKS. The
+ * table has a power of two number of locks, and lock stripe lk_addr (see
+ * USZRAM_PG_PER_LOCK) is controlled by the lock chosen by hashing lk_addr
+ * rather than by lk_addr itself, so that adjacent hot stripes rarely share a
+ * lock however small the table is.
+ *
+ * Resizing: lktbl_resize() takes every lock of the current table as a writer,
+ * publishes the new table in lktbl_current, and releases the old locks. So
+ * nobody holds a lock of the old table once the new one is current, and a
+ * thread that took a lock of a table that's no longer current releases it and
+ * retries with the new one (see lktbl_lock()). Threads may still be waiting on
+ * the locks of an old table, so tables are only freed by lktbl_exit(). Each
+ * size is allocated at most once and reused if the table shrinks and grows
+ * again, so the tables take less than twice the memory of the largest one. The
+ * smallest table is static, like the fixed lock table.
+ *
+ * Contention: lktbl_lock() tries each lock before waiting for it, and counts
+ * the tries and how many of them failed. Each thread adds its counts to the
+ * global ones every LKTBL_FLUSH tries, and every LKTBL_WINDOW tries, the table
+ * doubles if more than one in LKTBL_GROW had to wait, up to one lock per
+ * stripe. It never shrinks by itself, since contention can't tell when fewer
+ * locks would do; uszram_resize_locks() can shrink it.
+ *
+ * A thread must not hold any lock of the table when it calls lktbl_lock() or
+ * lktbl_resize(), since these may wait for all of them.
+ */
+
+#ifndef LOCK_TABLE_H
+#define LOCK_TABLE_H
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+#include "../uszram-def.h"
+#include "../locks-api.h"
+
+
+#define LKTBL_MIN_BITS 6u
+#define LKTBL_MAX_BITS 24u
+#define LKTBL_FLUSH    64u
+#define LKTBL_WINDOW   (1u << 16)
+#define LKTBL_GROW     64u
+
+#if USZRAM_ATOMIC_RANGES
+#  error USZRAM_DYNAMIC_LOCKS cannot be used with USZRAM_ATOMIC_RANGES
+#endif
+
+
+struct lock_table {
+	unsigned char  bits;
+	struct lock   *locks;	// NULL until the size is first used
+};
+
+static struct lock lktbl_min[1u << LKTBL_MIN_BITS];
+static struct lock_table lktbl_sizes[LKTBL_MAX_BITS + 1] = {
+	[LKTBL_MIN_BITS] = {.bits = LKTBL_MIN_BITS, .locks = lktbl_min},
+};
+static struct lock_table *_Atomic lktbl_current = lktbl_sizes + LKTBL_MIN_BITS;
+static atomic_uint_least64_t lktbl_bytes = sizeof lktbl_min;
+static atomic_flag lktbl_resizing = ATOMIC_FLAG_INIT;
+static atomic_uint_least32_t lktbl_tries, lktbl_waits;
+static _Thread_local unsigned lktbl_my_tries, lktbl_my_waits;
+
+/* lktbl_max_bits() returns log2 of the largest table size, the number of lock
+ * stripes rounded up to a power of two.
+ */
+static inline unsigned char lktbl_max_bits(void)
+{
+	unsigned char bits = LKTBL_MIN_BITS;
+	while (bits < LKTBL_MAX_BITS && (uint_least64_t)1 << bits < LOCK_COUNT)
+		++bits;
+	return bits;
+}
+
+static inline struct lock *lktbl_find(const struct lock_table *tbl,
+				      uint_least32_t lk_addr)
+{
+	const uint_least32_t hash = lk_addr * UINT32_C(2654435761);
+	return tbl->locks + (hash >> (32 - tbl->bits));
+}
+
+/* lktbl_get() returns the lock controlling lock stripe lk_addr in the current
+ * table. The result only stays valid while the caller holds a lock of the
+ * table.
+ */
+static inline struct lock *lktbl_get(uint_least32_t lk_addr)
+{
+	return lktbl_find(lktbl_current, lk_addr);
+}
+
+/* lktbl_index() returns the index of 'lock' in its table.
+ */
+static inline uint_least32_t lktbl_index(const struct lock *lock)
+{
+	for (unsigned char bits = LKTBL_MIN_BITS;; ++bits) {
+		const struct lock *const locks = lktbl_sizes[bits].locks;
+		const uint_least32_t count = (uint_least32_t)1 << bits;
+		if (locks && (uintptr_t)lock >= (uintptr_t)locks
+		    && (uintptr_t)lock < (uintptr_t)(locks + count))
+			return lock - locks;
+	}
+}
+
+/* lktbl_resize() makes the table 1 << bits locks, waiting for another resize to
+ * finish if 'wait' and otherwise giving up. Returns -1 if out of memory,
+ * otherwise 0.
+ */
+static int lktbl_resize(unsigned char bits, _Bool wait)
+{
+	while (atomic_flag_test_and_set(&lktbl_resizing))
+		if (wait)
+			sched_yield();
+		else
+			return 0;
+
+	struct lock_table *const old = lktbl_current,
+			  *const new = lktbl_sizes + bits;
+	const uint_least32_t count = (uint_least32_t)1 << bits,
+			     old_count = (uint_least32_t)1 << old->bits;
+	int ret = 0;
+	if (new == old)
+		goto out;
+	if (new->locks == NULL) {
+		struct lock *const locks = malloc(count * sizeof *locks);
+		if (locks == NULL) {
+			ret = -1;
+			goto out;
+		}
+		for (uint_least32_t i = 0; i != count; ++i)
+			initialize_lock(locks + i);
+		new->bits = bits;
+		new->locks = locks;
+		lktbl_bytes += count * sizeof *locks;
+	}
+	for (uint_least32_t i = 0; i != old_count; ++i)
+		lock_as_writer(old->locks + i);
+	lktbl_current = new;
+	for (uint_least32_t i = 0; i != old_count; ++i)
+		unlock_as_writer(old->locks + i);
+out:
+	atomic_flag_clear(&lktbl_resizing);
+	return ret;
+}
+
+/* lktbl_count() adds the calling thread's counts to the global ones and grows
+ * the table if a window of tries is over and had too much contention.
+ */
+static void lktbl_count(void)
+{
+	const uint_least32_t tries = lktbl_tries += lktbl_my_tries;
+	lktbl_waits += lktbl_my_waits;
+	lktbl_my_tries = lktbl_my_waits = 0;
+	if (tries < LKTBL_WINDOW)
+		return;
+	// Only the thread that resets the counters judges the window
+	if (!atomic_compare_exchange_strong(&lktbl_tries,
+					    &(uint_least32_t){tries}, 0))
+		return;
+	const uint_least32_t waits = atomic_exchange(&lktbl_waits, 0);
+	const unsigned char bits = lktbl_current->bits;
+	if (waits > tries / LKTBL_GROW && bits < lktbl_max_bits())
+		lktbl_resize(bits + 1, 0);
+}
+
+/* lktbl_lock() takes the lock controlling lock stripe lk_addr and returns it.
+ */
+static inline struct lock *lktbl_lock(uint_least32_t lk_addr, _Bool writer)
+{
+	if (++lktbl_my_tries == LKTBL_FLUSH)
+		lktbl_count();
+	for (;;) {
+		struct lock_table *const tbl = lktbl_current;
+		struct lock *const lk = lktbl_find(tbl, lk_addr);
+		if (writer ? trylock_as_writer(lk) : trylock_as_reader(lk)) {
+			++lktbl_my_waits;
+			if (writer)
+				lock_as_writer(lk);
+			else
+				lock_as_reader(lk);
+		}
+		if (lktbl_current == tbl)
+			return lk;
+		// The table was resized while we waited
+		if (writer)
+			unlock_as_writer(lk);
+		else
+			unlock_as_reader(lk);
+	}
+}
+
+/* lktbl_lock_all() takes every lock of the current table as a reader, and keeps
+ * the table from being resized until lktbl_unlock_all(). It's only used for
+ * statistics, so it bypasses USZRAM_LOCK_PROFILE.
+ */
+static void lktbl_lock_all(void)
+{
+	while (atomic_flag_test_and_set(&lktbl_resizing))
+		sched_yield();
+	const struct lock_table *const tbl = lktbl_current;
+	for (uint_least32_t i = 0; i != (uint_least32_t)1 << tbl->bits; ++i)
+		(lock_as_reader)(tbl->locks + i);
+}
+
+static void lktbl_unlock_all(void)
+{
+	const struct lock_table *const tbl = lktbl_current;
+	for (uint_least32_t i = 0; i != (uint_least32_t)1 << tbl->bits; ++i)
+		(unlock_as_reader)(tbl->locks + i);
+	atomic_flag_clear(&lktbl_resizing);
+}
+
+static inline void lktbl_init(void)
+{
+	for (uint_least32_t i = 0; i != 1u << LKTBL_MIN_BITS; ++i)
+		initialize_lock(lktbl_min + i);
+}
+
+/* lktbl_exit() destroys all locks and frees all tables but the smallest, which
+ * becomes current again.
+ */
+static inline void lktbl_exit(void)
+{
+	for (unsigned char bits = LKTBL_MIN_BITS; bits <= LKTBL_MAX_BITS;
+	     ++bits) {
+		struct lock *const locks = lktbl_sizes[bits].locks;
+		if (locks == NULL)
+			continue;
+		for (uint_least32_t i = 0; i != (uint_least32_t)1 << bits; ++i)
+			destroy_lock(locks + i);
+		if (bits != LKTBL_MIN_BITS) {
+			free(locks);
+			lktbl_sizes[bits].locks = NULL;
+		}
+	}
+	lktbl_current = lktbl_sizes + LKTBL_MIN_BITS;
+	lktbl_bytes = sizeof lktbl_min;
+	lktbl_tries = lktbl_waits = 0;
+}
+
+
+#endif // LOCK_TABLE_H
@@ -0,0 +1,189 @@
+/* uszram-bravo.h implements a big-reader lock after BRAVO (Dice and Kogan,
+ * "BRAVO: Biased Locking for Reader-Writer Locks", USENIX ATC 2019) on top of
+ * the readers-writer lock of futex-rw.h. Even an uncontended read lock of a
+ * plain readers-writer lock writes its shared reader count, so the lock's cache
+ * line bounces between all the reading cores. With BRAVO, while a lock is
+ * biased toward readers (rbias), a reader instead publishes itself in a slot of
+ * the global bravo_table chosen by hashing its thread and the lock, so readers
+ * on different cores write different cache lines.
+ *
+ * A writer takes the underlying lock, clears rbias, and waits until no slot
+ * holds the lock. This scan of the whole table is slow, so afterward rbias
+ * stays clear for BRAVO_INHIBIT times as long as the scan took, which bounds
+ * the slowdown of write-heavy locks. A reader whose slot is taken by another
+ * thread, or that finds rbias clear, takes the underlying lock as a reader,
+ * and restores rbias if the inhibition period is over.
+ *
+ * Each thread remembers the slots it holds in bravo_held, so that it can hold
+ * up to BRAVO_NEST read locks (e.g., a page's and the hot page cache's) through
+ * the fast path at once. Any more use the underlying lock.
+ */
+
+#ifndef USZRAM_BRAVO_H
+#define USZRAM_BRAVO_H
+
+
+#include <time.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "../locks-api.h"
+#include "futex-rw.h"
+
+
+#define BRAVO_SLOTS   4096u
+#define BRAVO_INHIBIT 9u
+#define BRAVO_NEST    4u
+
+
+struct lock {
+	struct futex_rw        rw;
+	atomic_bool            rbias;
+	atomic_uint_least64_t  inhibit_until;	// In ns, see bravo_now()
+};
+
+static struct lock *_Atomic bravo_table[BRAVO_SLOTS];
+static _Thread_local struct lock *_Atomic *bravo_held[BRAVO_NEST];
+
+static inline uint_least64_t bravo_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint_least64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* bravo_slot() returns the slot for the calling thread to read lock in,
+ * identifying the thread by the address of its bravo_held.
+ */
+static inline struct lock *_Atomic *bravo_slot(const struct lock *lock)
+{
+	const uint_least64_t hash = ((uintptr_t)&bravo_held ^ (uintptr_t)lock)
+				    * UINT64_C(0x9e3779b97f4a7c15);
+	return bravo_table + (hash >> 32) % BRAVO_SLOTS;
+}
+
+static inline int initialize_lock(struct lock *lock)
+{
+	atomic_init(&lock->rw.word, 0);
+	atomic_init(&lock->rbias, 0);
+	atomic_init(&lock->inhibit_until, 0);
+	return 0;
+}
+
+static inline int destroy_lock(struct lock *lock)
+{
+	(void)lock;
+	return 0;
+}
+
+/* bravo_fast_read() takes the lock as a reader through a slot of bravo_table if
+ * the lock is biased toward readers and the slot is free, and returns whether
+ * it did.
+ */
+static inline _Bool bravo_fast_read(struct lock *lock)
+{
+	unsigned char i = 0;
+	while (i < BRAVO_NEST && bravo_held[i])
+		++i;
+	if (!lock->rbias || i == BRAVO_NEST)
+		return 0;
+	struct lock *_Atomic *const slot = bravo_slot(lock);
+	struct lock *empty = NULL;
+	if (!atomic_compare_exchange_strong(slot, &empty, lock))
+		return 0;
+	// Recheck, in case a writer cleared rbias before it could see us in
+	// the slot
+	if (!lock->rbias) {
+		*slot = NULL;
+		return 0;
+	}
+	bravo_held[i] = slot;
+	return 1;
+}
+
+/* bravo_slow_read() is called after taking the underlying lock as a reader.
+ */
+static inline void bravo_slow_read(struct lock *lock)
+{
+	if (!lock->rbias && bravo_now() >= lock->inhibit_until)
+		lock->rbias = 1;
+}
+
+/* bravo_revoke() is called after taking the underlying lock as a writer. It
+ * waits for the readers in bravo_table to leave.
+ */
+static inline void bravo_revoke(struct lock *lock)
+{
+	if (!lock->rbias)
+		return;
+	lock->rbias = 0;
+	const uint_least64_t start = bravo_now();
+	for (unsigned i = 0; i < BRAVO_SLOTS; ++i)
+		for (unsigned n = 1; bravo_table[i] == lock; ++n)
+			if (n % FUTEX_MIN_SPINS)
+				futex_pause();
+			else
+				sched_yield();
+	const uint_least64_t now = bravo_now();
+	lock->inhibit_until = now + (now - start) * BRAVO_INHIBIT;
+}
+
+static inline int lock_as_reader(struct lock *lock)
+{
+	if (bravo_fast_read(lock))
+		return 0;
+	futex_rw_lock_reader(&lock->rw);
+	bravo_slow_read(lock);
+	return 0;
+}
+
+static inline int lock_as_writer(struct lock *lock)
+{
+	futex_rw_lock_writer(&lock->rw);
+	bravo_revoke(lock);
+	return 0;
+}
+
+static inline int trylock_as_reader(struct lock *lock)
+{
+	if (bravo_fast_read(lock))
+		return 0;
+	if (!futex_rw_trylock_reader(&lock->rw))
+		return -1;
+	bravo_slow_read(lock);
+	return 0;
+}
+
+/* trylock_as_writer() doesn't count waiting for the readers in bravo_table as
+ * waiting, since they can't be blocked for long.
+ */
+static inline int trylock_as_writer(struct lock *lock)
+{
+	if (!futex_rw_trylock_writer(&lock->rw))
+		return -1;
+	bravo_revoke(lock);
+	return 0;
+}
+
+static inline int unlock_as_reader(struct lock *lock)
+{
+	for (unsigned char i = 0; i < BRAVO_NEST; ++i)
+		if (bravo_held[i] && *bravo_held[i] == lock) {
+			atomic_store_explicit(bravo_held[i], NULL,
+					      memory_order_release);
+			bravo_held[i] = NULL;
+			return 0;
+		}
+	futex_rw_unlock_reader(&lock->rw);
+	return 0;
+}
+
+static inline int unlock_as_writer(struct lock *lock)
+{
+	futex_rw_unlock_writer(&lock->rw);
+	return 0;
+}
+
+
+#endif // USZRAM_BRAVO_H
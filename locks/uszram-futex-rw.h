@@ -0,0 +1,65 @@
+/* uszram-futex-rw.h selects the 4-byte readers-writer lock of futex-rw.h, kept
+ * in the lock table like the other locks.
+ */
+
+#ifndef USZRAM_FUTEX_RW_H
+#define USZRAM_FUTEX_RW_H
+
+
+#include "../locks-api.h"
+#include "futex-rw.h"
+
+
+struct lock {
+	struct futex_rw rw;
+};
+
+static inline int initialize_lock(struct lock *lock)
+{
+	atomic_init(&lock->rw.word, 0);
+	return 0;
+}
+
+static inline int destroy_lock(struct lock *lock)
+{
+	(void)lock;
+	return 0;
+}
+
+static inline int lock_as_reader(struct lock *lock)
+{
+	futex_rw_lock_reader(&lock->rw);
+	return 0;
+}
+
+static inline int lock_as_writer(struct lock *lock)
+{
+	futex_rw_lock_writer(&lock->rw);
+	return 0;
+}
+
+static inline int unlock_as_reader(struct lock *lock)
+{
+	futex_rw_unlock_reader(&lock->rw);
+	return 0;
+}
+
+static inline int unlock_as_writer(struct lock *lock)
+{
+	futex_rw_unlock_writer(&lock->rw);
+	return 0;
+}
+
+
+static inline int trylock_as_reader(struct lock *lock)
+{
+	return !futex_rw_trylock_reader(&lock->rw);
+}
+
+static inline int trylock_as_writer(struct lock *lock)
+{
+	return !futex_rw_trylock_writer(&lock->rw);
+}
+
+
+#endif // USZRAM_FUTEX_RW_H
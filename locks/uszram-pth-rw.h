@@ -42,4 +42,15 @@ static inline int unlock_as_writer(struct lock *lock)
 }
 
 
+static inline int trylock_as_reader(struct lock *lock)
+{
+	return pthread_rwlock_tryrdlock((pthread_rwlock_t *)lock);
+}
+
+static inline int trylock_as_writer(struct lock *lock)
+{
+	return pthread_rwlock_trywrlock((pthread_rwlock_t *)lock);
+}
+
+
 #endif // USZRAM_PTH_RW_H
@@ -43,4 +43,15 @@ static inline int unlock_as_writer(struct lock *lock)
 }
 
 
+static inline int trylock_as_reader(struct lock *lock)
+{
+	return mtx_trylock((mtx_t *)lock) != thrd_success;
+}
+
+static inline int trylock_as_writer(struct lock *lock)
+{
+	return mtx_trylock((mtx_t *)lock) != thrd_success;
+}
+
+
 #endif // USZRAM_STD_MTX_H
@@ -27,6 +27,41 @@ static inline void run_varying_threads(struct workload *w, struct test_timer *t,
 	}
 }
 
+#if USZRAM_LATENCY_SAMPLE
+static void print_latency(int indent)
+{
+	static const char *const names[USZRAM_LAT_COUNT] = {
+		"read_pg", "read_blk", "write_pg", "write_blk", "delete_pg",
+		"delete_blk", "lock", "decompress", "compress", "alloc",
+	};
+	printf("%*sLatency (ns): p50, p99, p99.9\n", indent, "");
+	for (int i = 0; i < USZRAM_LAT_COUNT; ++i)
+		if (uszram_latency(i, 1))
+			printf("%*s%-10s %9llu %9llu %9llu\n", indent + 2, "",
+			       names[i],
+			       (unsigned long long)uszram_latency(i, 0.5),
+			       (unsigned long long)uszram_latency(i, 0.99),
+			       (unsigned long long)uszram_latency(i, 0.999));
+}
+#endif
+
+#if USZRAM_LOCK_PROFILE
+static void print_hot_locks(int indent)
+{
+	struct uszram_lock_prof top[4];
+	const int found = uszram_hot_locks(top, sizeof top / sizeof *top);
+	printf("%*sHot locks: acquisitions, contended, wait (ns), hold (ns)\n",
+	       indent, "");
+	for (int i = 0; i < found; ++i)
+		printf("%*s%8llu %9llu %9llu %12llu %12llu\n", indent + 2, "",
+		       (unsigned long long)top[i].lock,
+		       (unsigned long long)top[i].acquisitions,
+		       (unsigned long long)top[i].contended,
+		       (unsigned long long)top[i].wait_ns,
+		       (unsigned long long)top[i].hold_ns);
+}
+#endif
+
 int main(int argc, char **argv)
 {
 	_Bool raw = argc > 1;
@@ -60,14 +95,21 @@ int main(int argc, char **argv)
 	};
 	struct test_timer t;
 	const unsigned char blks  [] = {0, 100},
-			    writes[] = {0, 100},
+			    writes[] = {0, 1, 100},
 			    comprs[] = {1, 2, 4};
 #ifdef USZRAM_STD_MTX
 	printf("USZRAM_STD_MTX\n");
 #elif defined USZRAM_PTH_MTX
 	printf("USZRAM_PTH_MTX\n");
+#elif defined USZRAM_FUTEX_RW
+	printf("USZRAM_FUTEX_RW\n");
+#elif defined USZRAM_BRAVO
+	printf("USZRAM_BRAVO\n");
 #else
 	printf("USZRAM_PTH_RW\n");
+#endif
+#if USZRAM_DYNAMIC_LOCKS
+	printf("USZRAM_DYNAMIC_LOCKS\n");
 #endif
 	printf("PAGE_SIZE:   %4u\n"
 	       "PG_PER_LOCK: %4u\n\n",
@@ -107,6 +149,18 @@ int main(int argc, char **argv)
 					printf("Thread count,Time (s),"
 					       "Throughput (requests/s)\n");
 				run_varying_threads(&work, &t, 16, 6, raw);
+#if USZRAM_DYNAMIC_LOCKS
+				printf("      Locks: %llu\n",
+				       (unsigned long long)uszram_lock_count());
+#endif
+#if USZRAM_LATENCY_SAMPLE
+				if (!raw)
+					print_latency(6);
+#endif
+#if USZRAM_LOCK_PROFILE
+				if (!raw)
+					print_hot_locks(6);
+#endif
 				printf("\n");
 			}
 		}
@@ -0,0 +1,31 @@
+/* features-config.h turns on the optional features that the default
+ * configuration leaves off, so that small-test.c checks what they do rather
+ * than only their disabled stubs. Build the small tests with it like
+ *   cc -pthread -DUSZRAM_CONFIG='"test/features-config.h"' main.c uszram.c \
+ *      test/small-test.c test/test-utils.c ... -llz4
+ * with main() calling run_small_tests().
+ */
+
+#undef  USZRAM_PTH_MTX
+#define USZRAM_FUTEX_RW
+#undef  USZRAM_LOCK_BATCH
+#define USZRAM_LOCK_BATCH    3u
+#undef  USZRAM_DYNAMIC_LOCKS
+#define USZRAM_DYNAMIC_LOCKS 1
+
+#undef  USZRAM_WBUF_PAGES
+#define USZRAM_WBUF_PAGES 8u
+
+#undef  USZRAM_LATENCY_SAMPLE
+#define USZRAM_LATENCY_SAMPLE 4u
+#undef  USZRAM_LOCK_PROFILE
+#define USZRAM_LOCK_PROFILE 1
+#undef  USZRAM_SHM_STATS
+#define USZRAM_SHM_STATS 1
+
+#undef  USZRAM_SETUP_THREADS
+#define USZRAM_SETUP_THREADS 4u
+#undef  USZRAM_FLAT_COMBINING
+#define USZRAM_FLAT_COMBINING 1
+#undef  USZRAM_FINGERPRINTS
+#define USZRAM_FINGERPRINTS 1
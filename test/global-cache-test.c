@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "test-utils.h"
+#include "../caches/global-cache.h"
+
+
+#if GLOBAL_SLOTS >= BLK_PER_PG
+#  error global-cache-test.c requires fewer slots than blocks per page
+#endif
+
+
+static void assert_pgeq(const char expected[static PAGE_SIZE],
+			const char actual[static PAGE_SIZE])
+{
+	for (size_type i = 0; i < PAGE_SIZE; ++i)
+		if (expected[i] != actual[i]) {
+			PRINT_ERROR("Pages differed at byte %u\n", i);
+			exit(EXIT_FAILURE);
+		}
+}
+
+/* read_hot() logs enough reads of the last GLOBAL_SLOTS blocks to trigger
+ * relearning. The later a block, the more often it's read.
+ */
+static void read_hot(struct cache_data *cache)
+{
+	// Each read is repeated GLOBAL_SAMPLE times so exactly one is sampled
+	for (unsigned i = 0; i < GLOBAL_RELEARN; ++i)
+		for (unsigned j = 0; j < GLOBAL_SAMPLE; ++j)
+			cache_log_read(cache,
+				       BLRNG(BLK_PER_PG - 1 - i % GLOBAL_SLOTS,
+					     1 + i % GLOBAL_SLOTS));
+}
+
+static void layout_test(const char *pg)
+{
+	struct cache_data cache = {0};
+	char cached[PAGE_SIZE], copy[PAGE_SIZE];
+
+	cache_pg_copy(&cache, pg, cached);
+	assert_equal(0, cache.layout);
+	assert_pgeq(pg, cached);
+
+	read_hot(&cache);
+	assert_equal(1, global_current);
+	for (unsigned char i = 0; i < GLOBAL_SLOTS; ++i)
+		assert_equal(BLK_PER_PG - 1 - i, global_front[1][i]);
+
+	// Compressing takes the new layout, which puts the hot blocks first
+	cache_pg_copy(&cache, pg, cached);
+	assert_equal(1, cache.layout);
+	assert_equal(1, global_refs[1]);
+	for (unsigned char i = 0; i < GLOBAL_SLOTS; ++i)
+		assert_equal((i + 1) * BLOCK_SIZE,
+			     bytes_needed(cache, BLRNG(BLK_PER_PG - 1 - i, 1)));
+	for (uint_least16_t blk = 0; blk < BLK_PER_PG; ++blk) {
+		cache_read(cache, BYRNG(blk * BLOCK_SIZE, BLOCK_SIZE), cached,
+			   copy);
+		for (size_type i = 0; i < BLOCK_SIZE; ++i)
+			assert_equal(pg[blk * BLOCK_SIZE + i], copy[i]);
+	}
+	memcpy(copy, cached, PAGE_SIZE);
+	uncache_pg(cache, copy);
+	assert_pgeq(pg, copy);
+
+	// A layout in use is never overwritten, and once all learned layouts
+	// are in use, new orderings are dropped
+	struct cache_data others[GLOBAL_LAYOUTS] = {{0}};
+	for (unsigned char i = 0; i < GLOBAL_LAYOUTS; ++i) {
+		for (unsigned j = 0; j < GLOBAL_SAMPLE * GLOBAL_RELEARN; ++j)
+			cache_log_read(&others[i], BLRNG(i, 1));
+		cache_raw_pg_copy(&others[i], pg, copy);
+	}
+	assert_equal(1, cache.layout);
+	for (unsigned char i = 0; i < GLOBAL_SLOTS; ++i)
+		assert_equal(BLK_PER_PG - 1 - i, global_front[1][i]);
+	memcpy(copy, cached, PAGE_SIZE);
+	uncache_pg(cache, copy);
+	assert_pgeq(pg, copy);
+
+	// Relayout from one learned layout to another
+	cache_pg(&cache, cached);
+	assert_equal(global_current, cache.layout);
+	assert_equal(0, global_refs[1]);
+	memcpy(copy, cached, PAGE_SIZE);
+	uncache_pg(cache, copy);
+	assert_pgeq(pg, copy);
+
+	cache_reset(&cache);
+	for (unsigned char i = 0; i < GLOBAL_LAYOUTS; ++i)
+		cache_reset(&others[i]);
+	for (unsigned char i = 0; i < GLOBAL_LAYOUTS; ++i)
+		assert_equal(0, global_refs[i]);
+}
+
+static void get_pg_ranges_test(const char *pg)
+{
+	struct cache_data cache = {0};
+	char cached[PAGE_SIZE], copy[PAGE_SIZE];
+	read_hot(&cache);
+	cache_raw_pg_copy(&cache, pg, cached);
+
+	for (uint_least16_t offset = 0; offset < BLK_PER_PG; ++offset)
+		for (uint_least16_t count = 1; offset + count <= BLK_PER_PG;
+		     ++count) {
+			BlkRange ret[MAX_PG_RANGES];
+			const unsigned char sub_count = get_pg_ranges(
+				cache, BLRNG(offset, count), ret);
+			char *dest = copy;
+			uint_least16_t max = 0;
+			for (unsigned char r = 0; r < sub_count; ++r) {
+				dest = memcpy_ret(dest, cached + ret[r].offset
+							* BLOCK_SIZE,
+						  ret[r].count * BLOCK_SIZE);
+				if (ret[r].offset + ret[r].count > max)
+					max = ret[r].offset + ret[r].count;
+			}
+			assert_equal(count * BLOCK_SIZE, dest - copy);
+			assert_safe(!memcmp(pg + offset * BLOCK_SIZE, copy,
+					    count * BLOCK_SIZE));
+			assert_equal(max * BLOCK_SIZE,
+				     bytes_needed(cache, BLRNG(offset, count)));
+		}
+	cache_reset(&cache);
+}
+
+static void exit_test(const char *pg)
+{
+	struct cache_data cache = {0};
+	char cached[PAGE_SIZE];
+	read_hot(&cache);
+	cache_exit();
+	assert_equal(0, global_current);
+	assert_equal(0, global_samples);
+	for (uint_least16_t blk = 0; blk < BLK_PER_PG; ++blk)
+		assert_equal(0, global_counts[blk]);
+
+	// Nothing learned before survives, so pages start in natural order
+	cache_raw_pg_copy(&cache, pg, cached);
+	assert_equal(0, cache.layout);
+	assert_pgeq(pg, cached);
+	cache_reset(&cache);
+}
+
+int main(void)
+{
+	char pg[PAGE_SIZE];
+	rand_populate(PAGE_SIZE, pg);
+
+	layout_test(pg);
+	get_pg_ranges_test(pg);
+	exit_test(pg);
+}
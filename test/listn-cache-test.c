@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "test-utils.h"
+#include "../caches/listn-cache.h"
+
+
+#if LISTN_SLOTS >= LISTN_MAX_COUNT || LISTN_SLOTS >= BLK_PER_PG
+#  error listn-cache-test.c requires fewer than 15 slots and fewer slots than \
+	 blocks per page
+#endif
+
+#define TEST_COUNT 64
+
+
+struct cache_test {
+	struct cache_data cache;
+	char pg[PAGE_SIZE];
+};
+
+/* slot_of() returns the position of blk in a page cached according to cache.
+ * It's the slow but obvious version of what listn-cache.h computes.
+ */
+static uint_least16_t slot_of(const struct cache_data *cache,
+			      uint_least16_t blk)
+{
+	unsigned char before = 0;
+	for (unsigned char i = 0; i < LISTN_SLOTS; ++i) {
+		if (cache->cur[i] == blk)
+			return i;
+		before += cache->cur[i] < blk;
+	}
+	return LISTN_SLOTS + blk - before;
+}
+
+static void rand_cur(unsigned char cur[static LISTN_SLOTS])
+{
+	for (unsigned char i = 0; i < LISTN_SLOTS; ++i) {
+		unsigned char j;
+		do {
+			cur[i] = rand() % BLK_PER_PG;
+			for (j = 0; j < i && cur[j] != cur[i]; ++j)
+				;
+		} while (j < i);
+	}
+}
+
+static void make_tests(const char *pg, struct cache_test *tests)
+{
+	for (unsigned char i = 0; i < TEST_COUNT; ++i) {
+		if (i == 0)
+			cache_reset(&tests[i].cache);
+		else
+			rand_cur(tests[i].cache.cur);
+		for (uint_least16_t b = 0; b < BLK_PER_PG; ++b)
+			memcpy(tests[i].pg + slot_of(&tests[i].cache, b)
+					     * BLOCK_SIZE,
+			       pg + b * BLOCK_SIZE, BLOCK_SIZE);
+	}
+}
+
+static void assert_blkeq(unsigned short blk_count,
+			 const char expected[static BLOCK_SIZE],
+			 const char actual[static BLOCK_SIZE])
+{
+	for (size_type i = 0; i < blk_count * BLOCK_SIZE; ++i)
+		if (expected[i] != actual[i]) {
+			PRINT_ERROR("Blocks differed at byte %u\n", i);
+			exit(EXIT_FAILURE);
+		}
+}
+
+static void assert_pgeq(const char expected[static PAGE_SIZE],
+			const char actual[static PAGE_SIZE])
+{
+	assert_blkeq(BLK_PER_PG, expected, actual);
+}
+
+static BlkRange rand_range(void)
+{
+	const uint_least16_t offset = rand() % BLK_PER_PG;
+	return BLRNG(offset, 1 + rand() % (BLK_PER_PG - offset));
+}
+
+static void uncache_pg_test(const char *expected,
+			    const struct cache_test *tests)
+{
+	for (unsigned char i = 0; i < TEST_COUNT; ++i) {
+		char copy[PAGE_SIZE];
+		memcpy(copy, tests[i].pg, sizeof copy);
+		uncache_pg(tests[i].cache, copy);
+		assert_pgeq(expected, copy);
+	}
+}
+
+static void cache_read_test(const char *expected,
+			    const struct cache_test *tests)
+{
+	for (unsigned char i = 0; i < TEST_COUNT; ++i)
+		for (unsigned char j = 0; j < 32; ++j) {
+			char copy[PAGE_SIZE];
+			const BlkRange blk = rand_range();
+			const ByteRange byte = {
+				.offset = blk.offset * BLOCK_SIZE,
+				.count  = blk.count  * BLOCK_SIZE,
+			};
+			cache_read(tests[i].cache, byte, tests[i].pg, copy);
+			assert_blkeq(blk.count, expected + byte.offset, copy);
+		}
+}
+
+static void get_pg_ranges_test(const char *expected,
+			       const struct cache_test *tests)
+{
+	for (unsigned char i = 0; i < TEST_COUNT; ++i)
+		for (unsigned char j = 0; j < 32; ++j) {
+			BlkRange ret[MAX_PG_RANGES];
+			const BlkRange blk = rand_range();
+			const unsigned char sub_count
+				= get_pg_ranges(tests[i].cache, blk, ret);
+			assert_safe(sub_count <= MAX_PG_RANGES);
+			size_type offset = blk.offset * BLOCK_SIZE;
+			for (unsigned char r = 0; r < sub_count; ++r) {
+				assert_blkeq(ret[r].count, expected + offset,
+					     tests[i].pg
+					     + ret[r].offset * BLOCK_SIZE);
+				offset += ret[r].count * BLOCK_SIZE;
+			}
+			assert_equal((blk.offset + blk.count) * BLOCK_SIZE,
+				     offset);
+		}
+}
+
+static void bytes_needed_test(const struct cache_test *tests)
+{
+	for (unsigned char i = 0; i < TEST_COUNT; ++i)
+		for (unsigned char j = 0; j < 32; ++j) {
+			const BlkRange blk = rand_range();
+			uint_least16_t max = 0;
+			for (uint_least16_t b = blk.offset;
+			     b < blk.offset + blk.count; ++b)
+				if (slot_of(&tests[i].cache, b) >= max)
+					max = slot_of(&tests[i].cache, b) + 1;
+			assert_equal(max * BLOCK_SIZE,
+				     bytes_needed(tests[i].cache, blk));
+		}
+}
+
+static void cache_log_read_test(void)
+{
+	struct cache_data cache = {0};
+	cache_init(&cache);
+
+	// A block read often enough is cached despite many one-off reads
+	for (unsigned i = 0; i < 100; ++i) {
+		cache_log_read(&cache, BLRNG(BLK_PER_PG - 1, 1));
+		cache_log_read(&cache, BLRNG(i % (BLK_PER_PG - 1), 1));
+		cache_log_read(&cache, BLRNG(BLK_PER_PG - 1, 1));
+	}
+	unsigned char next[LISTN_SLOTS];
+	listn_choose(&cache, next);
+	assert_equal(BLK_PER_PG - 1, next[0]);
+	for (unsigned char i = 0; i < LISTN_TRACKED; ++i)
+		assert_safe(listn_count(&cache, i) < LISTN_MAX_COUNT);
+
+	// Blocks are chosen most frequent first and the rest filled in order
+	cache_reset(&cache);
+	for (unsigned char i = 0; i < LISTN_SLOTS; ++i)
+		cache_log_read(&cache, BLRNG(BLK_PER_PG - 1 - i, i + 1));
+	listn_choose(&cache, next);
+	for (unsigned char i = 0; i < LISTN_SLOTS; ++i)
+		assert_equal(BLK_PER_PG - 1 - i, next[i]);
+
+	cache_reset(&cache);
+	cache_log_read(&cache, BLRNG(BLK_PER_PG - 1, 1));
+	listn_choose(&cache, next);
+	assert_equal(BLK_PER_PG - 1, next[0]);
+	for (unsigned char i = 1; i < LISTN_SLOTS; ++i)
+		assert_equal(i - 1, next[i]);
+}
+
+static void cache_pg_copy_test(const char *expected,
+			       const struct cache_test *tests)
+{
+	for (unsigned char i = 0; i < TEST_COUNT; ++i) {
+		char copy[PAGE_SIZE], pg[PAGE_SIZE];
+		struct cache_data cache = tests[i].cache;
+		const struct cache_test *cmp = tests + (i + 1) % TEST_COUNT;
+		// Make cmp's blocks the most frequently read, in order
+		for (unsigned char j = 0; j < LISTN_SLOTS; ++j)
+			for (unsigned char k = j; k < LISTN_SLOTS; ++k)
+				cache_log_read(&cache,
+					       BLRNG(cmp->cache.cur[j], 1));
+		cache_pg_copy(&cache, tests[i].pg, copy);
+		assert_pgeq(cmp->pg, copy);
+		memcpy(pg, tests[i].pg, sizeof pg);
+		cache = tests[i].cache;
+		cache_pg(&cache, pg);
+		uncache_pg(cache, pg);
+		assert_pgeq(expected, pg);
+		cache_raw_pg_copy(&cache, expected, copy);
+		uncache_pg(cache, copy);
+		assert_pgeq(expected, copy);
+	}
+}
+
+static void cache_reset_test(struct cache_test *tests)
+{
+	struct cache_data reset = {0};
+	cache_init(&reset);
+	for (unsigned char i = 0; i < TEST_COUNT; ++i) {
+		cache_reset(&tests[i].cache);
+		assert_safe(!memcmp(&reset, &tests[i].cache, sizeof reset));
+	}
+}
+
+int main(void)
+{
+	static struct cache_test tests[TEST_COUNT];
+
+	char pg[PAGE_SIZE];
+	srand(1);
+	rand_populate(PAGE_SIZE, pg);
+	make_tests(pg, tests);
+
+	uncache_pg_test(pg, tests);
+	cache_read_test(pg, tests);
+	get_pg_ranges_test(pg, tests);
+	bytes_needed_test(tests);
+	cache_log_read_test();
+	cache_pg_copy_test(pg, tests);
+	cache_reset_test(tests);
+}
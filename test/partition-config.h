@@ -0,0 +1,33 @@
+/* partition-config.h turns on partitions and atomic ranges, which can't be
+ * combined with USZRAM_DYNAMIC_LOCKS and so with features-config.h, along with
+ * futex locks, NUMA shards, one per partition, and the global cache. There are
+ * 3 partitions and shards, so they don't divide the stripes evenly. Build the
+ * small tests with it like
+ *   cc -pthread -DUSZRAM_CONFIG='"test/partition-config.h"' main.c uszram.c \
+ *      test/small-test.c test/test-utils.c ... -llz4
+ * with main() calling run_small_tests().
+ */
+
+#undef  USZRAM_LIST2_CACHE
+#define USZRAM_GLOBAL_CACHE
+
+#undef  USZRAM_PTH_MTX
+#define USZRAM_FUTEX_RW
+#undef  USZRAM_ATOMIC_RANGES
+#define USZRAM_ATOMIC_RANGES 1
+
+#undef  USZRAM_INLINE_BYTES
+#define USZRAM_INLINE_BYTES 32u
+
+#undef  USZRAM_LOCK_PROFILE
+#define USZRAM_LOCK_PROFILE 1
+
+#undef  USZRAM_SETUP_THREADS
+#define USZRAM_SETUP_THREADS 3u
+#undef  USZRAM_PARTITIONS
+#define USZRAM_PARTITIONS 3u
+#undef  USZRAM_FINGERPRINTS
+#define USZRAM_FINGERPRINTS 1
+
+#undef  USZRAM_NUMA_SHARDS
+#define USZRAM_NUMA_SHARDS 3u
@@ -1,6 +1,21 @@
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
 #include "small-test.h"
 #include "test-utils.h"
 
+#if USZRAM_PARTITIONS > 1
+#  include <sched.h>
+#endif
+#if USZRAM_SHM_STATS
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include "../uszram-shm.h"
+#endif
+
 
 #if USZRAM_BLK_PER_PG < 4 || USZRAM_PG_PER_LOCK < 4
 #  error small-test.c requires USZRAM_BLK_PER_PG and USZRAM_PG_PER_LOCK be >= 4
@@ -253,6 +268,675 @@ void blks_pgs_lks_test(void)
 	uszram_exit();
 }
 
+#define RELEASE_START (PGPLK - 1)
+#define RELEASE_PAGES (PGPLK + 2)
+
+static atomic_bool released;
+
+static void *release_checker(void *arg)
+{
+	(void)arg;
+	uszram_delete_pg(RELEASE_START, RELEASE_PAGES);
+	released = 1;
+	return NULL;
+}
+
+// Another thread must be able to take every lock of the range within seconds
+static void assert_released(void)
+{
+	released = 0;
+	pthread_t checker;
+	assert_equal(0, pthread_create(&checker, NULL, release_checker, NULL));
+	const struct timespec ms = {0, 1000000};
+	for (unsigned i = 0; !released && i != 5000; ++i)
+		nanosleep(&ms, NULL);
+	assert_safe(released);
+	pthread_join(checker, NULL);
+}
+
+void batch_release_test(void)
+{
+	uszram_init();
+
+	// The range ends in the middle of the first and last stripes and,
+	// unless USZRAM_LOCK_BATCH covers a whole stripe, crosses a batch
+	// boundary in the middle one
+	char pg[RELEASE_PAGES * PGSIZE], scratch[RELEASE_PAGES * PGSIZE];
+	rand_populate(sizeof pg, pg);
+	const uint_least32_t blk = RELEASE_START * BLKPPG,
+			     blocks = RELEASE_PAGES * BLKPPG;
+	for (unsigned op = 0; op != 6; ++op) {
+		uszram_write_pg(RELEASE_START, RELEASE_PAGES, pg);
+		switch (op) {
+		case 1:
+			pgs_read(RELEASE_START, RELEASE_PAGES, pg, scratch);
+			break;
+		case 2:
+			blks_read(blk, blocks, pg, scratch);
+			break;
+		case 3:
+			uszram_write_blk(blk + 1, blocks - 2, pg);
+			break;
+		case 4:
+			uszram_delete_blk(blk + 1, blocks - 2);
+			break;
+		case 5:
+			uszram_delete_pg(RELEASE_START, RELEASE_PAGES);
+			break;
+		}
+		assert_released();
+	}
+
+	assert_empty();
+	uszram_exit();
+}
+
+#define ATOMIC_START  (PGPLK - 1)
+#define ATOMIC_PAGES  (PGPLK + 2)
+#define ATOMIC_ROUNDS 2000
+
+static atomic_bool rewriting;
+
+// Rewrites the whole range with one byte per round, by pages or by blocks
+static void *range_rewriter(void *arg)
+{
+	(void)arg;
+	static char data[ATOMIC_PAGES * PGSIZE];
+	for (unsigned round = 1; round <= ATOMIC_ROUNDS; ++round) {
+		memset(data, round, sizeof data);
+		if (round % 2)
+			uszram_write_pg(ATOMIC_START, ATOMIC_PAGES, data);
+		else
+			uszram_write_blk(ATOMIC_START * BLKPPG,
+					 ATOMIC_PAGES * BLKPPG, data);
+	}
+	rewriting = 0;
+	return NULL;
+}
+
+void atomic_range_test(void)
+{
+	uszram_init();
+
+	// With USZRAM_ATOMIC_RANGES, readers of the range see one round's
+	// bytes throughout, never pages of different rounds
+	char scratch[ATOMIC_PAGES * PGSIZE];
+	rewriting = 1;
+	pthread_t writer;
+	assert_equal(0, pthread_create(&writer, NULL, range_rewriter, NULL));
+	for (unsigned i = 0; rewriting; ++i) {
+		if (i % 2)
+			assert_equal(0, uszram_read_pg(ATOMIC_START,
+						       ATOMIC_PAGES, scratch));
+		else
+			assert_equal(0, uszram_read_blk(ATOMIC_START * BLKPPG,
+							ATOMIC_PAGES * BLKPPG,
+							scratch));
+		if (USZRAM_ATOMIC_RANGES)
+			for (size_t j = 1; j != sizeof scratch; ++j)
+				assert_equal(scratch[0], scratch[j]);
+	}
+	pthread_join(writer, NULL);
+	assert_equal(0, uszram_read_pg(ATOMIC_START, ATOMIC_PAGES, scratch));
+	for (size_t j = 0; j != sizeof scratch; ++j)
+		assert_equal((char)ATOMIC_ROUNDS, scratch[j]);
+
+	uszram_delete_pg(ATOMIC_START, ATOMIC_PAGES);
+	assert_empty();
+	uszram_exit();
+}
+
+void flush_test(void)
+{
+	uszram_init();
+
+	char pg[PGSIZE] = {0}, blk[BLKSIZE], scratch[PGSIZE];
+	memset(blk, 'a', BLKSIZE);
+	uszram_write_pg(0, 1, pg);
+	for (unsigned i = 0; i < BLKPPG; ++i) {
+		uszram_write_blk(i, 1, blk);
+		memcpy(pg + i * BLKSIZE, blk, BLKSIZE);
+		one_pg_read(0, pg, scratch);
+	}
+	assert_equal(0, uszram_flush());
+	one_pg_read(0, pg, scratch);
+	assert_equal(0, uszram_pg_is_huge(0));
+
+	// Deleting every block frees the page, even from a write buffer
+	memset(blk, 'b', BLKSIZE);
+	uszram_write_blk(0, 1, blk);
+	uszram_delete_blk(0, BLKPPG);
+	assert_equal(0, uszram_pg_exists(0));
+	one_pg_read(0, memset(pg, 0, PGSIZE), scratch);
+
+	uszram_delete_pg(0, 1);
+
+	assert_empty();
+	uszram_exit();
+}
+
+void reread_test(void)
+{
+	uszram_init();
+
+	char pg[PGSIZE], blk[BLKSIZE], scratch[PGSIZE];
+	memset(pg, 'a', PGSIZE);
+	memset(blk, 'b', BLKSIZE);
+	uszram_write_pg(0, 1, pg);
+	for (unsigned i = 0; i < 4; ++i)
+		one_pg_read(0, pg, scratch);
+	uszram_write_blk(1, 1, blk);
+	memcpy(pg + BLKSIZE, blk, BLKSIZE);
+	for (unsigned i = 0; i < 4; ++i)
+		one_pg_read(0, pg, scratch);
+	uszram_delete_blk(1, 1);
+	memset(pg + BLKSIZE, 0, BLKSIZE);
+	one_pg_read(0, pg, scratch);
+
+	uszram_delete_pg(0, 1);
+	one_pg_read(0, memset(pg, 0, PGSIZE), scratch);
+
+	assert_empty();
+	uszram_exit();
+}
+
+void same_fill_test(void)
+{
+	uszram_init();
+
+	char pg[PGSIZE], blk[BLKSIZE], scratch[PGSIZE];
+	memset(pg, 'a', PGSIZE);
+	uszram_write_pg(0, 1, pg);
+	one_pg_read(0, pg, scratch);
+#if USZRAM_PACKED_PAGE
+	assert_equal(0, uszram_pg_heap(0));
+#endif
+	assert_equal(1, uszram_pg_exists(0));
+	memset(blk, 'b', BLKSIZE);
+	uszram_write_blk(1, 1, blk);
+	memcpy(pg + BLKSIZE, blk, BLKSIZE);
+	one_pg_read(0, pg, scratch);
+	uszram_write_blk(1, 1, memset(blk, 'a', BLKSIZE));
+	memcpy(pg + BLKSIZE, blk, BLKSIZE);
+	one_pg_read(0, pg, scratch);
+	uszram_delete_blk(0, 1);
+	memset(pg, 0, BLKSIZE);
+	one_blk_read(0, pg, scratch);
+	one_pg_read(0, pg, scratch);
+
+	uszram_delete_pg(0, 1);
+	assert_equal(0, uszram_pg_exists(0));
+
+	// Deleting every block of a same-filled or any other page deletes the
+	// page, as does deleting any block of a zero-filled one
+	uszram_write_pg(0, 1, memset(pg, 'a', PGSIZE));
+	uszram_delete_blk(0, BLKPPG);
+	assert_equal(0, uszram_pg_exists(0));
+	assert_equal(0, uszram_pages_stored());
+	uszram_write_pg(0, 1, memset(pg, 0, PGSIZE));
+	assert_equal(1, uszram_pg_exists(0));
+	uszram_delete_blk(1, 1);
+	assert_equal(0, uszram_pg_exists(0));
+	one_pg_read(0, pg, scratch);
+	rand_populate(PGSIZE, pg);	// Likely huge
+	uszram_write_pg(0, 1, pg);
+	uszram_delete_blk(0, BLKPPG);
+	assert_equal(0, uszram_pg_exists(0));
+
+	assert_empty();
+	uszram_exit();
+}
+
+void tiny_pg_test(void)
+{
+	uszram_init();
+
+	// The page moves between tiny (maybe stored inline) and larger sizes,
+	// and the heap it's reported to use must match the store's total once
+	// write buffers are flushed
+	char pg[PGSIZE], blk[BLKSIZE], scratch[PGSIZE];
+	memset(pg, 0, PGSIZE);
+	pg[0] = 'a';
+	uszram_write_pg(0, 1, pg);
+	one_pg_read(0, pg, scratch);
+	assert_equal(uszram_total_heap(), uszram_pg_heap(0));
+	rand_populate(BLKSIZE, blk);
+	uszram_write_blk(1, 1, blk);
+	memcpy(pg + BLKSIZE, blk, BLKSIZE);
+	one_pg_read(0, pg, scratch);
+	uszram_flush();
+	assert_equal(uszram_total_heap(), uszram_pg_heap(0));
+	uszram_delete_blk(1, 1);
+	memset(pg + BLKSIZE, 0, BLKSIZE);
+	one_pg_read(0, pg, scratch);
+	one_blk_read(0, pg, scratch);
+	uszram_flush();
+	assert_equal(uszram_total_heap(), uszram_pg_heap(0));
+	pg[1] = 'b';
+	uszram_write_pg(0, 1, pg);
+	one_pg_read(0, pg, scratch);
+	assert_equal(uszram_total_heap(), uszram_pg_heap(0));
+
+	uszram_delete_pg(0, 1);
+	assert_empty();
+	uszram_exit();
+}
+
+void lock_resize_test(void)
+{
+	uszram_init();
+
+	char pg[PGSIZE], scratch[PGSIZE];
+	rand_populate(PGSIZE, pg);
+	uszram_write_pg(0, 1, pg);
+#if USZRAM_DYNAMIC_LOCKS
+	// The pages stay put as the lock table grows and shrinks around them
+	const uint_least64_t stripes = (USZRAM_PAGE_COUNT - 1) / PGPLK + 1;
+	assert_equal(64, uszram_lock_count());
+	assert_equal(0, uszram_resize_locks(100));
+	assert_equal(stripes > 64 ? 128 : 64, uszram_lock_count());
+	one_pg_read(0, pg, scratch);
+	uszram_write_pg(1, 1, pg);
+	assert_equal(0, uszram_resize_locks(1));
+	assert_equal(64, uszram_lock_count());
+	one_pg_read(0, pg, scratch);
+	one_pg_read(1, pg, scratch);
+#else
+	assert_equal(-1, uszram_resize_locks(1));
+	assert_equal((USZRAM_PAGE_COUNT - 1) / PGPLK + 1, uszram_lock_count());
+	one_pg_read(0, pg, scratch);
+	uszram_write_pg(1, 1, pg);
+#endif
+
+	uszram_delete_pg(0, 2);
+	assert_empty();
+	uszram_exit();
+}
+
+void stats_test(void)
+{
+	uszram_init();
+
+	char pg[PGSIZE], scratch[PGSIZE];
+	rand_populate(PGSIZE, pg);
+	uszram_write_pg(0, 1, pg);
+	uszram_write_pg(2, 1, pg);
+	assert_equal(0, uszram_read_pg(2, 1, scratch));
+	struct uszram_stats stats;
+	assert_equal(0, uszram_get_stats(&stats));
+	assert_equal(2, stats.pages_stored);
+	assert_equal(2, stats.pg_writes);
+	assert_equal(PGSIZE, stats.bytes_read);
+	uint_least64_t sum = 0;
+	for (unsigned i = 0; i < USZRAM_SIZE_BUCKETS; ++i)
+		sum += stats.size_hist[i];
+	assert_equal(2, sum);
+
+	uszram_delete_pg(0, 3);
+	assert_empty();
+	uszram_exit();
+}
+
+void latency_test(void)
+{
+	uszram_init();
+
+	char pg[PGSIZE], scratch[PGSIZE];
+	rand_populate(PGSIZE, pg);
+	uszram_write_pg(0, 1, pg);
+#if USZRAM_LATENCY_SAMPLE
+	// Enough reads for at least one to be sampled
+	for (unsigned i = 0; i < USZRAM_LATENCY_SAMPLE; ++i)
+		assert_equal(0, uszram_read_pg(0, 1, scratch));
+	const uint_least64_t p50 = uszram_latency(USZRAM_LAT_READ_PG, 0.5);
+	assert_safe(p50 > 0);
+	assert_safe(p50 <= uszram_latency(USZRAM_LAT_READ_PG, 1));
+	assert_equal(0, uszram_latency(USZRAM_LAT_DELETE_BLK, 0.5));
+#else
+	assert_equal(0, uszram_read_pg(0, 1, scratch));
+	assert_equal(0, uszram_latency(USZRAM_LAT_READ_PG, 0.5));
+#endif
+
+	uszram_delete_pg(0, 1);
+	assert_empty();
+	uszram_exit();
+}
+
+void lock_profile_test(void)
+{
+	uszram_init();
+
+	char pg[PGSIZE], scratch[PGSIZE];
+	rand_populate(PGSIZE, pg);
+	uszram_write_pg(PGPLK, 1, pg);
+	one_pg_read(PGPLK, pg, scratch);
+#if USZRAM_LOCK_PROFILE
+	// Only one lock was taken, so it's the hottest
+	struct uszram_lock_prof top[2];
+	assert_equal(1, uszram_hot_locks(top, 2));
+	assert_safe(top[0].acquisitions >= 2);
+	assert_safe(top[0].contended == 0);
+#  if !USZRAM_DYNAMIC_LOCKS
+	assert_equal(1, top[0].lock);
+#  endif
+	// Taking statistics doesn't count
+	const uint_least64_t acquisitions = top[0].acquisitions;
+	struct uszram_stats snap;
+	assert_equal(0, uszram_get_stats(&snap));
+	assert_equal(1, uszram_hot_locks(top, 2));
+	assert_safe(top[0].acquisitions == acquisitions);
+#else
+	assert_equal(-1, uszram_hot_locks(NULL, 0));
+#endif
+
+	uszram_delete_pg(PGPLK, 1);
+	assert_empty();
+	uszram_exit();
+}
+
+void shm_stats_test(void)
+{
+	uszram_init();
+
+	char pg[PGSIZE];
+	rand_populate(PGSIZE, pg);
+	uszram_write_pg(USZRAM_PAGE_COUNT - 1, 1, pg);
+#if USZRAM_SHM_STATS
+	assert_equal(0, uszram_publish_stats());
+	const int fd = shm_open(USZRAM_SHM_NAME, O_RDONLY, 0);
+	assert_safe(fd != -1);
+	const struct uszram_shm *const shm = mmap(NULL, sizeof *shm, PROT_READ,
+						  MAP_SHARED, fd, 0);
+	close(fd);
+	assert_safe(shm != MAP_FAILED);
+	assert_safe(uszram_shm_check(shm));
+	static struct uszram_shm copy;
+	uszram_shm_read(shm, &copy);
+	assert_equal(1, copy.published);
+	assert_equal(1, copy.stats.pages_stored);
+	assert_equal(1, copy.regions[USZRAM_SHM_REGIONS - 1].pages_stored);
+	munmap((void *)shm, sizeof *shm);
+#else
+	assert_equal(-1, uszram_publish_stats());
+#endif
+
+	uszram_delete_pg(USZRAM_PAGE_COUNT - 1, 1);
+	assert_empty();
+	uszram_exit();
+}
+
+void occupancy_test(void)
+{
+	uszram_init();
+
+	char pg[PGSIZE], blk[BLKSIZE];
+	rand_populate(PGSIZE, pg);
+	rand_populate(BLKSIZE, blk);
+	assert_equal(USZRAM_PAGE_COUNT, uszram_next_pg(0));
+	uszram_write_pg(3, 1, pg);
+	uszram_write_blk(USZRAM_BLOCK_COUNT - 1, 1, blk);
+	assert_equal(3, uszram_next_pg(0));
+	assert_equal(3, uszram_next_pg(3));
+	assert_equal(USZRAM_PAGE_COUNT - 1, uszram_next_pg(4));
+	assert_equal(USZRAM_PAGE_COUNT, uszram_next_pg(USZRAM_PAGE_COUNT));
+
+	assert_equal(0, uszram_delete_all());
+	assert_equal(USZRAM_PAGE_COUNT, uszram_next_pg(0));
+	assert_empty();
+	uszram_exit();
+}
+
+void setup_test(void)
+{
+	// Twice, so that the second uszram_init() follows a uszram_exit() of
+	// a store with a page in every stripe, all of which must be reset
+	char pg[PGSIZE], scratch[PGSIZE];
+	rand_populate(PGSIZE, pg);
+	for (unsigned round = 0; round != 2; ++round) {
+		uszram_init();
+		assert_empty();
+		assert_equal(USZRAM_PAGE_COUNT, uszram_next_pg(0));
+		for (uint_least64_t i = 0; i < USZRAM_PAGE_COUNT; i += PGPLK) {
+			uszram_write_pg(i, 1, pg);
+			assert_equal(0, uszram_read_blk(i * BLKPPG + 1, 1,
+							scratch));
+			assert_equal(0, memcmp(pg + BLKSIZE, scratch, BLKSIZE));
+		}
+		assert_equal((USZRAM_PAGE_COUNT - 1) / PGPLK + 1,
+			     uszram_pages_stored());
+		if (round == 0) {
+			assert_equal(0, uszram_delete_all());
+			assert_empty();
+			for (uint_least64_t i = 0; i < USZRAM_PAGE_COUNT;
+			     i += PGPLK)
+				uszram_write_pg(i, 1, pg);
+		}
+		uszram_exit();
+	}
+	assert_empty();
+}
+
+void numa_shard_test(void)
+{
+	uszram_init();
+
+	char pg[PGSIZE], scratch[PGSIZE];
+	rand_populate(PGSIZE, pg);
+	uszram_write_pg(USZRAM_PAGE_COUNT - 1, 1, pg);
+	// Shards are whole stripes, all but the last of the same size
+	const unsigned shards = USZRAM_NUMA_SHARDS ? USZRAM_NUMA_SHARDS : 1;
+	const uint_least64_t stripes = (USZRAM_PAGE_COUNT - 1) / PGPLK + 1,
+			     per_shard = (stripes - 1) / shards + 1;
+	assert_equal(0, uszram_pg_shard(0));
+	assert_equal(0, uszram_pg_shard(per_shard * PGPLK - 1));
+	assert_equal((stripes - 1) / per_shard,
+		     uszram_pg_shard(USZRAM_PAGE_COUNT - 1));
+	if (USZRAM_PARTITIONS == USZRAM_NUMA_SHARDS)
+		for (uint_least64_t i = 0; i < USZRAM_PAGE_COUNT; i += PGPLK)
+			assert_equal(uszram_partition(i), uszram_pg_shard(i));
+	one_pg_read(USZRAM_PAGE_COUNT - 1, pg, scratch);
+
+	uszram_delete_pg(USZRAM_PAGE_COUNT - 1, 1);
+	assert_empty();
+	uszram_exit();
+}
+
+#if USZRAM_PARTITIONS > 1
+static atomic_bool owner_ready, owner_done;
+
+static void *partition_owner(void *arg)
+{
+	(void)arg;
+	assert_equal(0, uszram_own(1));
+	owner_ready = 1;
+	while (!owner_done)
+		if (uszram_serve() == 0)
+			sched_yield();
+	return NULL;
+}
+#endif
+
+void partition_test(void)
+{
+	uszram_init();
+
+#if USZRAM_PARTITIONS > 1
+	char pg[2 * PGSIZE], scratch[2 * PGSIZE];
+	rand_populate(2 * PGSIZE, pg);
+	assert_equal(0, uszram_own(0));
+	assert_equal(-1, uszram_own(0));
+	assert_equal(-1, uszram_own(1));	// Already owns one
+	pthread_t owner;
+	assert_equal(0, pthread_create(&owner, NULL, partition_owner, NULL));
+	while (!owner_ready)
+		;
+	uint_least32_t edge = PGPLK;
+	while (uszram_partition(edge) == 0)
+		edge += PGPLK;
+
+	// Split into a write of our own page and one forwarded to the owner
+	uszram_write_pg(edge - 1, 2, pg);
+	assert_equal(1, uszram_pg_exists(edge));
+	assert_equal(0, uszram_read_pg(edge - 1, 2, scratch));
+	assert_equal(0, memcmp(pg, scratch, 2 * PGSIZE));
+	assert_equal(0, uszram_serve());
+
+	uszram_delete_pg(edge - 1, 2);
+	assert_equal(0, uszram_pages_stored());
+	assert_equal(0, uszram_pg_heap(edge));
+	owner_done = 1;
+	pthread_join(owner, NULL);
+#else
+	assert_equal(-1, uszram_serve());
+	assert_equal(0, uszram_partition(USZRAM_PAGE_COUNT - 1));
+	assert_empty();
+#endif
+	uszram_exit();
+}
+
+#define COMBINE_THREADS 4
+#define COMBINE_ROUNDS  100
+
+// Thread t writes blocks t, t + COMBINE_THREADS, ... of page 1
+static void *combine_writer(void *arg)
+{
+	const unsigned t = (unsigned)(uintptr_t)arg;
+	char blk[BLKSIZE];
+	for (unsigned round = 0; round != COMBINE_ROUNDS; ++round) {
+		memset(blk, t * COMBINE_ROUNDS + round, BLKSIZE);
+		for (unsigned i = t; i < BLKPPG; i += COMBINE_THREADS)
+			uszram_write_blk(BLKPPG + i, 1, blk);
+	}
+	return NULL;
+}
+
+void combine_test(void)
+{
+	uszram_init();
+
+	char pg[PGSIZE], expected[PGSIZE];
+	memset(pg, 7, PGSIZE);
+	uszram_write_pg(1, 1, pg);
+#if USZRAM_FLAT_COMBINING
+	pthread_t threads[COMBINE_THREADS];
+	for (unsigned t = 0; t != COMBINE_THREADS; ++t)
+		assert_equal(0, pthread_create(threads + t, NULL,
+					       combine_writer,
+					       (void *)(uintptr_t)t));
+	for (unsigned t = 0; t != COMBINE_THREADS; ++t)
+		pthread_join(threads[t], NULL);
+#else
+	for (unsigned t = 0; t != COMBINE_THREADS; ++t)
+		combine_writer((void *)(uintptr_t)t);
+#endif
+	for (unsigned i = 0; i != BLKPPG; ++i)
+		memset(expected + i * BLKSIZE, // The last round's byte
+		       (i % COMBINE_THREADS + 1) * COMBINE_ROUNDS - 1, BLKSIZE);
+	assert_equal(0, uszram_read_pg(1, 1, pg));
+	assert_equal(0, memcmp(expected, pg, PGSIZE));
+	assert_equal(1, uszram_pages_stored());
+
+	uszram_exit();
+}
+
+void fingerprint_test(void)
+{
+	uszram_init();
+
+	// Rewrite two pages, only the second of which changed, so only it is
+	// compressed, even with USZRAM_ATOMIC_RANGES compressing ahead of the
+	// locks
+	char pg[2 * PGSIZE], scratch[2 * PGSIZE];
+	rand_populate(2 * PGSIZE, pg);
+	uszram_write_pg(0, 2, pg);
+	uint_least64_t compr = uszram_num_compr();
+	rand_populate(PGSIZE, pg + PGSIZE);
+	uszram_write_pg(0, 2, pg);
+	struct uszram_stats stats;
+	assert_equal(0, uszram_get_stats(&stats));
+	assert_equal(USZRAM_FINGERPRINTS ? 1 : 0, stats.elided_writes);
+	assert_equal(USZRAM_FINGERPRINTS ? 1 : 2, uszram_num_compr() - compr);
+	pgs_read(0, 2, pg, scratch);
+
+	// A block write clears the fingerprint, so the first page's write isn't
+	// elided this time, but the second one's is
+	uszram_write_blk(0, 1, pg + BLKSIZE);
+	compr = uszram_num_compr();
+	uszram_write_pg(0, 2, pg);
+	assert_equal(0, uszram_get_stats(&stats));
+	assert_equal(USZRAM_FINGERPRINTS ? 2 : 0, stats.elided_writes);
+	assert_equal(USZRAM_FINGERPRINTS ? 1 : 2, uszram_num_compr() - compr);
+	pgs_read(0, 2, pg, scratch);
+
+	uszram_delete_pg(0, 2);
+	assert_empty();
+	uszram_exit();
+}
+
+#define RELAYOUT_ROUNDS 4
+#define RELAYOUT_READS  (1u << 17)
+#define RELAYOUT_WRITES 20000u
+
+static char relayout_pg[2][PGSIZE];
+static atomic_bool relayout_stop;
+
+// Alternates between the two contents of page 0
+static void *relayout_writer(void *arg)
+{
+	(void)arg;
+	while (!relayout_stop) {
+		uszram_write_pg(0, 1, relayout_pg[1]);
+		uszram_write_pg(0, 1, relayout_pg[0]);
+	}
+	return NULL;
+}
+
+void relayout_test(void)
+{
+	uszram_init();
+
+	// Each round makes another block hot, checks that a page written next
+	// caches it, and then races writes of the same data to one page, whose
+	// elided writes must give up what they staged. A layout still counted
+	// as in use after that could never be replaced by a newly learned one.
+	for (unsigned i = 0; i != BLKPPG; ++i) {
+		memset(relayout_pg[0] + i * BLKSIZE, 'a' + i, BLKSIZE);
+		memset(relayout_pg[1] + i * BLKSIZE, 'A' + i, BLKSIZE);
+	}
+	char blk[BLKSIZE];
+	for (unsigned round = 0; round != RELAYOUT_ROUNDS; ++round) {
+		const unsigned hot = BLKPPG - 1 - round % BLKPPG;
+		uszram_write_pg(1, 1, relayout_pg[0]);
+		for (unsigned i = 0; i != RELAYOUT_READS; ++i)
+			assert_equal(0, uszram_read_blk(BLKPPG + hot, 1, blk));
+		uszram_write_pg(2, 1, relayout_pg[0]);
+		struct uszram_stats before, after;
+		assert_equal(0, uszram_get_stats(&before));
+		assert_equal(0, uszram_read_blk(2 * BLKPPG + hot, 1, blk));
+		assert_equal(0, uszram_get_stats(&after));
+		assert_equal('a' + hot, blk[0]);
+#ifdef USZRAM_GLOBAL_CACHE
+		if (hot >= 2 * USZRAM_CACHE_SLOTS)
+			assert_safe(after.bytes_decompressed
+				    - before.bytes_decompressed
+				    <= USZRAM_CACHE_SLOTS * BLKSIZE);
+#endif
+
+		relayout_stop = 0;
+		pthread_t writer;
+		assert_equal(0, pthread_create(&writer, NULL, relayout_writer,
+					       NULL));
+		for (unsigned i = 0; i != RELAYOUT_WRITES; ++i)
+			uszram_write_pg(0, 1, relayout_pg[0]);
+		relayout_stop = 1;
+		pthread_join(writer, NULL);
+		uszram_delete_pg(0, 3);
+	}
+
+	assert_empty();
+	uszram_exit();
+}
+
 void run_small_tests(void)
 {
 	empty_test();
@@ -263,4 +947,22 @@ void run_small_tests(void)
 	blks_1pg_test();
 	blks_pgs_1lk_test();
 	blks_pgs_lks_test();
+	batch_release_test();
+	atomic_range_test();
+	flush_test();
+	reread_test();
+	same_fill_test();
+	tiny_pg_test();
+	lock_resize_test();
+	stats_test();
+	latency_test();
+	lock_profile_test();
+	shm_stats_test();
+	occupancy_test();
+	setup_test();
+	numa_shard_test();
+	partition_test();
+	combine_test();
+	fingerprint_test();
+	relayout_test();
 }
@@ -12,6 +12,25 @@ void one_blk_test(void);
 void blks_1pg_test(void);
 void blks_pgs_1lk_test(void);
 void blks_pgs_lks_test(void);
+void batch_release_test(void);
+void atomic_range_test(void);
+
+void flush_test(void);
+void reread_test(void);
+void same_fill_test(void);
+void tiny_pg_test(void);
+void lock_resize_test(void);
+void stats_test(void);
+void latency_test(void);
+void lock_profile_test(void);
+void shm_stats_test(void);
+void occupancy_test(void);
+void setup_test(void);
+void numa_shard_test(void);
+void partition_test(void);
+void combine_test(void);
+void fingerprint_test(void);
+void relayout_test(void);
 
 void run_small_tests(void);
 
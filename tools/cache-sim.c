@@ -0,0 +1,89 @@
+/* cache-sim simulates the caching strategy selected in uszram.h on its own,
+ * without compressing anything, to compare how many bytes of a page a read of
+ * one block has to decompress:
+ *	cache-sim [zipf [pages [reads [shared]]]]
+ * Each page has a Zipf(zipf) popularity over its blocks, in a random order
+ * that is the same for every page if shared is 1 (as for the global cache) or
+ * differs per page if it's 0 (as for list2 and listN). Each read has a 1/8
+ * chance of recompressing its page. The first fifth of the reads only warms up
+ * the cache. It prints the average bytes needed per read with the cache and
+ * in natural order.
+ *
+ * COMPILE:
+ * cc -O2 tools/cache-sim.c -lm
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../uszram-page.h"
+
+
+#define RECOMPRESS 8u
+
+
+int main(int argc, char **argv)
+{
+	const double zipf = argc > 1 ? strtod(argv[1], NULL) : 0.8;
+	const unsigned long pages = argc > 2 ? strtoul(argv[2], NULL, 10) : 2000,
+			    reads = argc > 3 ? strtoul(argv[3], NULL, 10)
+					     : 1000000;
+	const _Bool shared = argc > 4 && atoi(argv[4]);
+	struct cache_data *const cache = calloc(pages, sizeof *cache);
+	unsigned char (*const order)[BLK_PER_PG] = malloc(pages
+							  * sizeof *order);
+	if (pages == 0 || cache == NULL || order == NULL) {
+		fprintf(stderr, "usage: %s [zipf [pages [reads [shared]]]]\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	double cdf[BLK_PER_PG], sum = 0;
+	for (unsigned i = 0; i < BLK_PER_PG; ++i)
+		cdf[i] = sum += 1 / pow(i + 1, zipf);
+	srand(7);
+	for (unsigned long p = 0; p < pages; ++p) {
+		cache_init(cache + p);
+		if (shared && p) {
+			memcpy(order[p], order[0], BLK_PER_PG);
+			continue;
+		}
+		for (unsigned i = 0; i < BLK_PER_PG; ++i)
+			order[p][i] = i;
+		for (unsigned i = BLK_PER_PG - 1; i > 0; --i) {
+			const unsigned j = rand() % (i + 1);
+			const unsigned char tmp = order[p][i];
+			order[p][i] = order[p][j];
+			order[p][j] = tmp;
+		}
+	}
+
+	static char pg[PAGE_SIZE];
+	double cached = 0, natural = 0;
+	unsigned long counted = 0;
+	for (unsigned long r = 0; r < reads; ++r) {
+		const unsigned long p = rand() % pages;
+		const double u = (double)rand() / RAND_MAX * sum;
+		unsigned k = 0;
+		while (k < BLK_PER_PG - 1 && cdf[k] < u)
+			++k;
+		const unsigned blk = order[p][k];
+		if (r >= reads / 5) {
+			cached += bytes_needed(cache[p], BLRNG(blk, 1));
+			natural += (blk + 1) * BLOCK_SIZE;
+			++counted;
+		}
+		cache_log_read(cache + p, BLRNG(blk, 1));
+		if (rand() % RECOMPRESS == 0)
+			cache_pg(cache + p, pg);
+	}
+	printf("%u-byte pages, zipf %.2f, %s order: %.0f bytes per read "
+	       "cached, %.0f natural\n", PAGE_SIZE, zipf,
+	       shared ? "shared" : "per-page", cached / counted,
+	       natural / counted);
+
+	free(order);
+	free(cache);
+	return 0;
+}
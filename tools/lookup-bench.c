@@ -0,0 +1,118 @@
+/* lookup-bench measures the cost of looking up pages at random addresses, to
+ * compare the placements of USZRAM_TABLE_HUGEPAGES, USZRAM_NUMA_INTERLEAVE, and
+ * USZRAM_NUMA_NODE. It stores every page, then times 'lookups' calls of
+ * uszram_pg_size() at random addresses, split among 'threads' threads:
+ *	lookup-bench [lookups [threads]]
+ * Build it once per placement and compare the times. On a host with several
+ * sockets, run it with threads on all of them (e.g., under numactl) to see the
+ * effect of the NUMA options.
+ *
+ * COMPILE:
+ * cc -O2 -pthread tools/lookup-bench.c uszram.c ... -llz4
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../uszram.h"
+
+
+struct bench_thread {
+	pthread_t       thread;
+	uint_least64_t  seed,
+			lookups,
+			sum;	// Keeps the lookups from being optimized out
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *lookup_thread(void *arg)
+{
+	struct bench_thread *const b = arg;
+	uint_least64_t x = b->seed | 1, sum = 0;
+	for (uint_least64_t i = 0; i != b->lookups; ++i) {
+		// xorshift64
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		sum += uszram_pg_size(x % USZRAM_PAGE_COUNT);
+	}
+	b->sum = sum;
+	return NULL;
+}
+
+static void print_huge_pages(void)
+{
+	FILE *const f = fopen("/proc/self/smaps_rollup", "r");
+	if (f == NULL)
+		return;
+	char line[128];
+	while (fgets(line, sizeof line, f))
+		if (strncmp(line, "AnonHugePages:", 14) == 0)
+			printf("%s", line);
+	fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	const uint_least64_t lookups = argc > 1 ? strtoull(argv[1], NULL, 10)
+						: 1ull << 24;
+	const unsigned threads = argc > 2 ? strtoul(argv[2], NULL, 10) : 1;
+	if (threads == 0) {
+		fprintf(stderr, "usage: %s [lookups [threads]]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("USZRAM_TABLE_HUGEPAGES: %d\n"
+	       "USZRAM_NUMA_INTERLEAVE: %d\n"
+	       "USZRAM_NUMA_NODE:       %d\n"
+	       "Pages:                  %llu\n",
+	       USZRAM_TABLE_HUGEPAGES, USZRAM_NUMA_INTERLEAVE,
+	       USZRAM_NUMA_NODE, (unsigned long long)USZRAM_PAGE_COUNT);
+
+	uszram_init();
+	static char pg[USZRAM_PAGE_SIZE];
+	double start = now_sec();
+	for (uint_least64_t i = 0; i != USZRAM_PAGE_COUNT; ++i) {
+		memcpy(pg, &i, sizeof i);
+		uszram_write_pg(i, 1, pg);
+	}
+	printf("Populated in %.3f s\n", now_sec() - start);
+	print_huge_pages();
+
+	struct bench_thread *const b = calloc(threads, sizeof *b);
+	if (b == NULL)
+		return EXIT_FAILURE;
+	start = now_sec();
+	for (unsigned i = 0; i != threads; ++i) {
+		b[i].seed = 0x9e3779b97f4a7c15u * (i + 1);
+		b[i].lookups = lookups / threads;
+		if (pthread_create(&b[i].thread, NULL, lookup_thread, b + i)) {
+			perror("pthread_create");
+			return EXIT_FAILURE;
+		}
+	}
+	uint_least64_t sum = 0;
+	for (unsigned i = 0; i != threads; ++i) {
+		pthread_join(b[i].thread, NULL);
+		sum += b[i].sum;
+	}
+	const double sec = now_sec() - start;
+	printf("%llu lookups, %u thread%s: %.3f s, %.1f ns per lookup "
+	       "(checksum %llu)\n",
+	       (unsigned long long)(lookups / threads * threads), threads,
+	       threads == 1 ? "" : "s", sec,
+	       sec * 1e9 * threads / (lookups / threads * threads),
+	       (unsigned long long)sum);
+
+	free(b);
+	uszram_exit();
+	return 0;
+}
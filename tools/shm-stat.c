@@ -0,0 +1,118 @@
+/* shm-stat prints the statistics that a store configured with USZRAM_SHM_STATS
+ * publishes in shared memory (see uszram-shm.h), once or every 'interval'
+ * seconds:
+ *	shm-stat [interval [name]]
+ * It must be compiled with the same uszram.h as the store.
+ *
+ * COMPILE:
+ * cc tools/shm-stat.c -o shm-stat [-lrt]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../uszram-shm.h"
+
+
+static const char *const lat_names[USZRAM_LAT_COUNT] = {
+	"read_pg", "read_blk", "write_pg", "write_blk", "delete_pg",
+	"delete_blk", "lock", "decompress", "compress", "alloc",
+};
+
+static void print_shm(const struct uszram_shm *shm)
+{
+	const struct uszram_stats *const st = &shm->stats;
+	printf("Publication %llu at %llu.%03llu s\n",
+	       (unsigned long long)shm->published,
+	       (unsigned long long)(shm->time_ns / 1000000000u),
+	       (unsigned long long)(shm->time_ns / 1000000u % 1000u));
+	printf("  Total size:         %llu\n"
+	       "  Total heap:         %llu\n"
+	       "  Pages stored:       %llu\n"
+	       "  Huge pages:         %llu\n"
+	       "  Compressions:       %llu\n"
+	       "  Failed:             %llu\n"
+	       "  Compressed bytes:   %llu\n"
+	       "  Allocator overhead: %llu\n"
+	       "  Pages written:      %llu\n"
+	       "  Writes elided:      %llu\n"
+	       "  Bytes read:         %llu\n"
+	       "  Bytes decompressed: %llu\n",
+	       (unsigned long long)st->total_size,
+	       (unsigned long long)st->total_heap,
+	       (unsigned long long)st->pages_stored,
+	       (unsigned long long)st->huge_pages,
+	       (unsigned long long)st->num_compr,
+	       (unsigned long long)st->failed_compr,
+	       (unsigned long long)st->compr_bytes,
+	       (unsigned long long)st->alloc_overhead,
+	       (unsigned long long)st->pg_writes,
+	       (unsigned long long)st->elided_writes,
+	       (unsigned long long)st->bytes_read,
+	       (unsigned long long)st->bytes_decompressed);
+
+	printf("  Compressed sizes (sixteenths of a page): ");
+	for (unsigned i = 0; i < USZRAM_SIZE_BUCKETS; ++i)
+		printf(" %llu", (unsigned long long)st->size_hist[i]);
+	printf("\n");
+
+	for (unsigned i = 0; i < USZRAM_LAT_COUNT; ++i)
+		if (shm->latency[i][0])
+			printf("  %-10s p50 %9llu p99 %9llu p99.9 %9llu ns\n",
+			       lat_names[i],
+			       (unsigned long long)shm->latency[i][0],
+			       (unsigned long long)shm->latency[i][1],
+			       (unsigned long long)shm->latency[i][2]);
+
+	printf("  Regions of %llu pages: pages stored, compressed bytes\n",
+	       (unsigned long long)USZRAM_SHM_PG_PER_REGION);
+	for (unsigned i = 0; i < USZRAM_SHM_REGIONS; ++i)
+		if (shm->regions[i].pages_stored)
+			printf("  %4u %10llu %14llu\n", i,
+			       (unsigned long long)shm->regions[i].pages_stored,
+			       (unsigned long long)
+			       shm->regions[i].compr_bytes);
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned interval = argc > 1 ? strtoul(argv[1], NULL, 10) : 0;
+	const char *const name = argc > 2 ? argv[2] : USZRAM_SHM_NAME;
+
+	const int fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1) {
+		perror(name);
+		return EXIT_FAILURE;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof (struct uszram_shm)) {
+		fprintf(stderr, "%s: not set up yet\n", name);
+		return EXIT_FAILURE;
+	}
+	const struct uszram_shm *const shm = mmap(NULL, sizeof *shm, PROT_READ,
+						  MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		perror(name);
+		return EXIT_FAILURE;
+	}
+	if (!uszram_shm_check(shm)) {
+		fprintf(stderr, "%s: published by a differently configured "
+				"store\n", name);
+		return EXIT_FAILURE;
+	}
+
+	static struct uszram_shm copy;
+	for (;;) {
+		uszram_shm_read(shm, &copy);
+		print_shm(&copy);
+		if (interval == 0)
+			break;
+		sleep(interval);
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,75 @@
+/* uszram-combine.h implements USZRAM_FLAT_COMBINING. A block write confined to
+ * one page is a struct comb_req on the stack of the writer, which pushes it
+ * onto the queue of the page's lock stripe, a lock-free stack, and then takes
+ * the stripe's lock as a writer. Whoever gets the lock takes every request in
+ * the queue with comb_take() and does them all, so writers that were waiting
+ * for the lock usually find their requests done when they get it, and only
+ * have to release it. uszram.c does the requests of each page together, so
+ * that the page is decompressed and compressed once for all of them.
+ */
+
+#ifndef USZRAM_COMBINE_H
+#define USZRAM_COMBINE_H
+
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "uszram-def.h"
+
+
+struct comb_req {
+	struct comb_req  *next;
+	const char       *data,
+			 *orig;
+	uint_least32_t    pg_addr;
+	BlkRange          blk;
+	atomic_bool       done;
+};
+
+static struct comb_req *_Atomic combq[LOCK_COUNT];
+
+static inline void comb_push(uint_least32_t lk_addr, struct comb_req *req)
+{
+	atomic_init(&req->done, 0);
+	req->next = atomic_load_explicit(combq + lk_addr, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(combq + lk_addr,
+						      &req->next, req,
+						      memory_order_release,
+						      memory_order_relaxed))
+		;
+}
+
+/* comb_take() empties the queue of lock stripe lk_addr, whose lock the calling
+ * thread holds as a writer, and returns its requests in the order they were
+ * pushed, so that overlapping writes are applied in that order.
+ */
+static struct comb_req *comb_take(uint_least32_t lk_addr)
+{
+	struct comb_req *req = atomic_exchange_explicit(combq + lk_addr, NULL,
+							memory_order_acquire),
+			*first = NULL;
+	while (req) {
+		struct comb_req *const next = req->next;
+		req->next = first;
+		first = req;
+		req = next;
+	}
+	return first;
+}
+
+/* comb_done() tells the writer of req that it's done. The writer's stack frame
+ * is gone once it sees this, so req must not be touched afterward.
+ */
+static inline void comb_done(struct comb_req *req)
+{
+	atomic_store_explicit(&req->done, 1, memory_order_release);
+}
+
+static inline _Bool comb_is_done(struct comb_req *req)
+{
+	return atomic_load_explicit(&req->done, memory_order_acquire);
+}
+
+
+#endif // USZRAM_COMBINE_H
@@ -0,0 +1,70 @@
+/* uszram-fingerprint.h implements USZRAM_FINGERPRINTS. pgfp holds a fingerprint
+ * of each page last stored by uszram_write_pg(), or 0 if it has none, and
+ * fingerprint() computes the fingerprint of a page of data. A fingerprint is
+ * only a filter: a page write whose fingerprint matches is still compared with
+ * the stored page before it's skipped, so a collision costs a decompression,
+ * not data. The hash mixes a word at a time in four independent lanes, so it
+ * runs at several bytes per cycle, far faster than any compressor.
+ *
+ * Fingerprints only change with the page's lock held as a writer. Anything
+ * else that changes a stored page must call fp_forget(). With
+ * USZRAM_ATOMIC_RANGES, stage_pgs() also reads them without the lock, to skip
+ * compressing pages that look unchanged, so they're atomic.
+ */
+
+#ifndef USZRAM_FINGERPRINT_H
+#define USZRAM_FINGERPRINT_H
+
+
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "uszram-def.h"
+
+
+#define FP_MUL UINT64_C(0x9e3779b97f4a7c15)
+
+
+static atomic_uint_least32_t pgfp[USZRAM_PAGE_COUNT];
+
+static inline uint_least64_t fp_mix(uint_least64_t h, uint_least64_t word)
+{
+	h = (h ^ word) * FP_MUL;
+	return h ^ h >> 32;
+}
+
+static uint_least32_t fingerprint(const char data[static PAGE_SIZE])
+{
+	uint_least64_t lane[4] = {1, 2, 3, 4}, word;
+	uint_least32_t i = 0;
+	for (; i + 4 * sizeof word <= PAGE_SIZE; i += 4 * sizeof word)
+		for (unsigned j = 0; j != 4; ++j) {
+			memcpy(&word, data + i + j * sizeof word, sizeof word);
+			lane[j] = fp_mix(lane[j], word);
+		}
+	for (; i != PAGE_SIZE; ++i)
+		lane[0] = fp_mix(lane[0], (unsigned char)data[i]);
+	uint_least64_t h = fp_mix(fp_mix(fp_mix(lane[0], lane[1]), lane[2]),
+				  lane[3]);
+	h = (uint_least32_t)(h ^ h >> 32);
+	return h ? h : 1;	// 0 means no fingerprint
+}
+
+static inline uint_least32_t fp_get(uint_least32_t pg_addr)
+{
+	return atomic_load_explicit(pgfp + pg_addr, memory_order_relaxed);
+}
+
+static inline void fp_set(uint_least32_t pg_addr, uint_least32_t fp)
+{
+	atomic_store_explicit(pgfp + pg_addr, fp, memory_order_relaxed);
+}
+
+static inline void fp_forget(uint_least32_t pg_addr)
+{
+	fp_set(pg_addr, 0);
+}
+
+
+#endif // USZRAM_FINGERPRINT_H
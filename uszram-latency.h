@@ -0,0 +1,144 @@
+/* uszram-latency.h keeps the latency histograms of USZRAM_LATENCY_SAMPLE.
+ *
+ * Sampling: each thread counts its operations and times every
+ * USZRAM_LATENCY_SAMPLE-th one (lat_begin() to lat_finish()). While it does,
+ * the phases of that operation are timed as well (lat_phase() to lat_end()),
+ * so the phases cost nothing in unsampled operations either.
+ *
+ * Histograms: like HdrHistogram, the buckets are log-linear. Latencies below
+ * 1 << LAT_SUB_BITS ns each have their own bucket, and every power of two above
+ * that is split into 1 << LAT_SUB_BITS buckets, so a bucket's width is at most
+ * 1 / (1 << LAT_SUB_BITS) of the latencies in it, from 1 ns up to
+ * 1 << LAT_MAX_BITS ns (about 18 minutes) with a few hundred buckets. As with
+ * the statistics, threads count into LAT_SHARDS shards, so that they rarely
+ * write the same cache lines, and uszram_latency() sums the shards.
+ */
+
+#ifndef USZRAM_LATENCY_H
+#define USZRAM_LATENCY_H
+
+
+#include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "uszram.h"
+
+
+#define LAT_SUB_BITS 3u
+#define LAT_MAX_BITS 40u
+#define LAT_BUCKETS  ((LAT_MAX_BITS - LAT_SUB_BITS + 1) << LAT_SUB_BITS)
+#define LAT_SHARDS   16u
+
+
+static atomic_uint_least32_t lat_counts[LAT_SHARDS][USZRAM_LAT_COUNT]
+				       [LAT_BUCKETS];
+static atomic_uint lat_next;
+static _Thread_local atomic_uint_least32_t (*lat_mine)[LAT_BUCKETS];
+static _Thread_local unsigned lat_tick;
+static _Thread_local _Bool lat_on;
+
+static inline uint_least64_t lat_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint_least64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static inline unsigned lat_bucket(uint_least64_t ns)
+{
+	if (ns < 1u << LAT_SUB_BITS)
+		return ns;
+	if (ns >> LAT_MAX_BITS)
+		return LAT_BUCKETS - 1;
+	unsigned bits = LAT_SUB_BITS;
+	while (ns >> (bits + 1))
+		++bits;
+	return ((bits - LAT_SUB_BITS + 1) << LAT_SUB_BITS)
+	       + (ns >> (bits - LAT_SUB_BITS)) - (1u << LAT_SUB_BITS);
+}
+
+/* lat_limit() returns the largest latency counted in 'bucket'.
+ */
+static inline uint_least64_t lat_limit(unsigned bucket)
+{
+	++bucket;
+	if (bucket < 2u << LAT_SUB_BITS)
+		return bucket - 1;
+	const unsigned shift = (bucket >> LAT_SUB_BITS) - 1;
+	const uint_least64_t sub = bucket & ((1u << LAT_SUB_BITS) - 1);
+	return (((1u << LAT_SUB_BITS) + sub) << shift) - 1;
+}
+
+/* lat_begin() returns the time if the calling thread is to time the operation
+ * it is starting, otherwise 0.
+ */
+static inline uint_least64_t lat_begin(void)
+{
+	if (++lat_tick % USZRAM_LATENCY_SAMPLE)
+		return 0;
+	lat_on = 1;
+	return lat_now();
+}
+
+/* lat_phase() returns the time if the calling thread is timing its current
+ * operation, otherwise 0.
+ */
+static inline uint_least64_t lat_phase(void)
+{
+	return lat_on ? lat_now() : 0;
+}
+
+/* lat_end() counts the time since 'start', as returned by lat_begin() or
+ * lat_phase(), as a latency of 'what'. Does nothing if start is 0.
+ */
+static inline void lat_end(enum uszram_lat what, uint_least64_t start)
+{
+	if (start == 0)
+		return;
+	if (lat_mine == NULL)
+		lat_mine = lat_counts[atomic_fetch_add_explicit(
+			&lat_next, 1, memory_order_relaxed) % LAT_SHARDS];
+	const unsigned bucket = lat_bucket(lat_now() - start);
+	atomic_fetch_add_explicit(lat_mine[what] + bucket, 1,
+				  memory_order_relaxed);
+}
+
+static inline void lat_finish(enum uszram_lat what, uint_least64_t start)
+{
+	lat_end(what, start);
+	lat_on = 0;
+}
+
+static uint_least64_t lat_quantile(enum uszram_lat what, double quantile)
+{
+	uint_least64_t counts[LAT_BUCKETS] = {0}, total = 0;
+	for (unsigned i = 0; i < LAT_SHARDS; ++i)
+		for (unsigned b = 0; b < LAT_BUCKETS; ++b)
+			counts[b] += atomic_load_explicit(
+				lat_counts[i][what] + b, memory_order_relaxed);
+	for (unsigned b = 0; b < LAT_BUCKETS; ++b)
+		total += counts[b];
+	if (total == 0)
+		return 0;
+	// The rank of the sample at the quantile, counting from 1
+	uint_least64_t rank = quantile * total;
+	if (rank < quantile * total || rank == 0)
+		++rank;
+	unsigned b = 0;
+	for (uint_least64_t seen = counts[0]; seen < rank; seen += counts[b])
+		++b;
+	return lat_limit(b);
+}
+
+static void lat_clear(void)
+{
+	for (unsigned i = 0; i < LAT_SHARDS; ++i)
+		for (unsigned w = 0; w < USZRAM_LAT_COUNT; ++w)
+			for (unsigned b = 0; b < LAT_BUCKETS; ++b)
+				atomic_store_explicit(lat_counts[i][w] + b, 0,
+						      memory_order_relaxed);
+}
+
+
+#endif // USZRAM_LATENCY_H
@@ -0,0 +1,96 @@
+/* uszram-occupancy.h keeps a two-level bitmap of the pages that are stored, so
+ * that uszram_delete_all(), uszram_exit(), uszram_get_stats(), and
+ * uszram_next_pg() visit only those instead of the whole page table. Only
+ * uszram_delete_all() also skips the locks of stripes that have none;
+ * uszram_get_stats() still takes every lock and uses the bitmap only for its
+ * scan of the pages. occ_pages has a bit per page, and occ_words a bit per word
+ * of occ_pages that may be nonzero, so a scan of an empty store reads one bit
+ * per 4096 pages.
+ *
+ * The bits of a page only change with its lock held as a writer, but a word
+ * covers pages of different locks, so the words are updated atomically. A
+ * summary bit is set by whoever sets the first bit of its word, and cleared by
+ * whoever clears the last one, who then checks that no bit was set in the
+ * meantime (since its setter may have set the summary bit before it was
+ * cleared) and sets the summary bit again if one was. So a nonzero word always
+ * has its summary bit set, though a zero word may briefly have it set too.
+ *
+ * Since the bits are atomic, occ_test() can tell whether a page exists without
+ * its lock, unlike pg_exists(), which reads fields that change under the lock.
+ * A page's bit is set before its data is stored, so a thread that sees the bit
+ * and then takes the lock still has to check pg_exists() in case the page was
+ * deleted in the meantime.
+ */
+
+#ifndef USZRAM_OCCUPANCY_H
+#define USZRAM_OCCUPANCY_H
+
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "uszram-def.h"
+
+
+#define OCC_WORDS   ((USZRAM_PAGE_COUNT - 1) / 64 + 1)
+#define OCC_SUMMARY ((OCC_WORDS - 1) / 64 + 1)
+
+
+static atomic_uint_least64_t occ_pages[OCC_WORDS], occ_words[OCC_SUMMARY];
+
+static inline void occ_set(uint_least32_t pg_addr)
+{
+	const uint_least64_t word = pg_addr / 64;
+	if (atomic_fetch_or(occ_pages + word, (uint_least64_t)1 << pg_addr % 64)
+	    == 0)
+		atomic_fetch_or(occ_words + word / 64,
+				(uint_least64_t)1 << word % 64);
+}
+
+static inline _Bool occ_test(uint_least32_t pg_addr)
+{
+	return occ_pages[pg_addr / 64] >> pg_addr % 64 & 1;
+}
+
+static inline void occ_clear(uint_least32_t pg_addr)
+{
+	const uint_least64_t word = pg_addr / 64,
+			     bit = (uint_least64_t)1 << pg_addr % 64;
+	if (atomic_fetch_and(occ_pages + word, ~bit) != bit)
+		return;
+	atomic_fetch_and(occ_words + word / 64,
+			 ~((uint_least64_t)1 << word % 64));
+	if (occ_pages[word])
+		atomic_fetch_or(occ_words + word / 64,
+				(uint_least64_t)1 << word % 64);
+}
+
+/* occ_next() returns the address of the first stored page at or after pg_addr,
+ * or USZRAM_PAGE_COUNT if there is none.
+ */
+static uint_least64_t occ_next(uint_least64_t pg_addr)
+{
+	if (pg_addr >= USZRAM_PAGE_COUNT)
+		return USZRAM_PAGE_COUNT;
+	uint_least64_t word = pg_addr / 64,
+		       bits = occ_pages[word]
+			      & ~(uint_least64_t)0 << pg_addr % 64;
+	while (bits == 0) {
+		if (++word == OCC_WORDS)
+			return USZRAM_PAGE_COUNT;
+		uint_least64_t summary = word / 64,
+			       sbits = occ_words[summary]
+				       & ~(uint_least64_t)0 << word % 64;
+		while (sbits == 0) {
+			if (++summary == OCC_SUMMARY)
+				return USZRAM_PAGE_COUNT;
+			sbits = occ_words[summary];
+		}
+		word = summary * 64 + __builtin_ctzll(sbits);
+		bits = occ_pages[word];
+	}
+	return word * 64 + __builtin_ctzll(bits);
+}
+
+
+#endif // USZRAM_OCCUPANCY_H
@@ -2,6 +2,11 @@
 #define USZRAM_PAGE_H
 
 
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
 #include "uszram-def.h"
 
 #ifdef USZRAM_BASIC
@@ -17,11 +22,28 @@
 #include "cache-api.h"
 #ifdef USZRAM_LIST2_CACHE
 #  include "caches/list2-cache.h"
+#elif defined USZRAM_LISTN_CACHE
+#  include "caches/listn-cache.h"
+#elif defined USZRAM_GLOBAL_CACHE
+#  include "caches/global-cache.h"
 #endif
 
 
+#if !USZRAM_PACKED_PAGE
+
+/* With USZRAM_INLINE_BYTES, compressed data that fits in inline_data is stored
+ * there, in place of the pointer, instead of on the heap. The allocator tracks
+ * which of the two is in use in alloc_data.inlined.
+ */
 struct page {
+#if USZRAM_INLINE_BYTES
+	union {
+		char *_Atomic data;
+		char inline_data[USZRAM_INLINE_BYTES];
+	};
+#else
 	char *_Atomic data;
+#endif
 #ifndef NO_ALLOC_METADATA
 	struct alloc_data alloc_data;
 #endif
@@ -33,5 +55,195 @@ struct page {
 #endif
 };
 
+static inline _Bool pg_is_inline(const struct page *pg)
+{
+#if USZRAM_INLINE_BYTES
+	return pg->alloc_data.inlined;
+#else
+	(void)pg;
+	return 0;
+#endif
+}
+
+static inline char *pg_data(const struct page *pg)
+{
+#if USZRAM_INLINE_BYTES
+	if (pg_is_inline(pg))
+		return (char *)pg->inline_data;
+#endif
+	return pg->data;
+}
+
+static inline void set_pg_data(struct page *pg, char *data)
+{
+	pg->data = data;
+}
+
+static inline struct compr_data pg_compr(const struct page *pg)
+{
+	return pg->compr_data;
+}
+
+static inline void set_pg_compr(struct page *pg, struct compr_data compr)
+{
+	pg->compr_data = compr;
+}
+
+static inline _Bool pg_fill(const struct page *pg, unsigned char *fill)
+{
+	(void)pg, (void)fill;
+	return 0;
+}
+
+#else
+
+/* With USZRAM_PACKED_PAGE, all of a page's metadata is packed into one 64-bit
+ * word, from the least significant bit:
+ * - 45 bits hold pg->data shifted right by 3, which assumes that allocations
+ *   are 8-byte aligned and user-space addresses fit in 48 bits, as on x86-64
+ *   and AArch64. A same-filled page (below) has no data and instead keeps the
+ *   byte it's filled with here.
+ * - 16 bits hold struct compr_data, so pages can be at most 32 KiB.
+ * - 1 bit is set if the page is same-filled: every byte of it is the same, so
+ *   it's stored without any heap data.
+ * - 2 bits hold struct cache_data, so only caching strategies that define
+ *   CACHE_PACKED_BITS as at most 2 can be used.
+ *
+ * Fields are only changed with the page's lock held as a writer, except the
+ * cache bits, which readers may change concurrently with each other, so they
+ * are updated with a compare-and-swap.
+ */
+
+#if USZRAM_INLINE_BYTES
+#  error USZRAM_PACKED_PAGE cannot be used with USZRAM_INLINE_BYTES
+#endif
+#if USZRAM_PAGE_SHIFT > 15
+#  error USZRAM_PACKED_PAGE requires pages of at most 32 KiB
+#endif
+#if !defined NO_ALLOC_METADATA || defined NO_COMPR_METADATA
+#  error USZRAM_PACKED_PAGE requires an allocator without metadata and a \
+	 compressor with metadata
+#endif
+#if !defined USZRAM_NO_CACHING \
+    && !(defined CACHE_PACKED_BITS && CACHE_PACKED_BITS <= 2)
+#  error USZRAM_PACKED_PAGE requires USZRAM_GLOBAL_CACHE or USZRAM_NO_CACHING
+#endif
+
+#define PG_PTR_SHIFT   3
+#define PG_PTR_BITS    45
+#define PG_COMPR_SHIFT PG_PTR_BITS
+#define PG_FILL_SHIFT  (PG_COMPR_SHIFT + 16)
+#define PG_CACHE_SHIFT (PG_FILL_SHIFT + 1)
+#define PG_PTR_MASK    (((uint_least64_t)1 << PG_PTR_BITS) - 1)
+#define PG_COMPR_MASK  ((uint_least64_t)0xffff << PG_COMPR_SHIFT)
+#define PG_FILL_FLAG   ((uint_least64_t)1 << PG_FILL_SHIFT)
+#define PG_CACHE_MASK  ((uint_least64_t)3 << PG_CACHE_SHIFT)
+
+struct page {
+	atomic_uint_least64_t word;
+};
+
+static inline uint_least64_t pg_word(const struct page *pg)
+{
+	return atomic_load_explicit(&pg->word, memory_order_relaxed);
+}
+
+static inline void set_pg_word(struct page *pg, uint_least64_t mask,
+			       uint_least64_t bits)
+{
+	atomic_store_explicit(&pg->word, (pg_word(pg) & ~mask) | bits,
+			      memory_order_release);
+}
+
+static inline char *pg_data(const struct page *pg)
+{
+	const uint_least64_t word = pg_word(pg);
+	if (word & PG_FILL_FLAG)
+		return NULL;
+	return (char *)(uintptr_t)((word & PG_PTR_MASK) << PG_PTR_SHIFT);
+}
+
+/* set_pg_data() also clears the same-fill flag. data must fit the assumptions
+ * above; without assertions, the bits that don't are lost rather than
+ * overwriting the other fields.
+ */
+static inline void set_pg_data(struct page *pg, char *data)
+{
+	assert((uintptr_t)data % ((uintptr_t)1 << PG_PTR_SHIFT) == 0
+	       && (uintptr_t)data >> (PG_PTR_BITS + PG_PTR_SHIFT) == 0);
+	set_pg_word(pg, PG_PTR_MASK | PG_FILL_FLAG,
+		    (uintptr_t)data >> PG_PTR_SHIFT & PG_PTR_MASK);
+}
+
+static inline struct compr_data pg_compr(const struct page *pg)
+{
+	return (struct compr_data){
+		.size = (pg_word(pg) & PG_COMPR_MASK) >> PG_COMPR_SHIFT,
+	};
+}
+
+static inline void set_pg_compr(struct page *pg, struct compr_data compr)
+{
+	set_pg_word(pg, PG_COMPR_MASK,
+		    (uint_least64_t)compr.size << PG_COMPR_SHIFT);
+}
+
+static inline _Bool pg_is_inline(const struct page *pg)
+{
+	(void)pg;
+	return 0;
+}
+
+/* pg_fill() returns whether pg is same-filled, and if so, writes the byte it's
+ * filled with to fill.
+ */
+static inline _Bool pg_fill(const struct page *pg, unsigned char *fill)
+{
+	const uint_least64_t word = pg_word(pg);
+	*fill = word & 0xff;
+	return word & PG_FILL_FLAG;
+}
+
+/* set_pg_fill() makes pg same-filled with 'fill'. pg must have no heap data.
+ */
+static inline void set_pg_fill(struct page *pg, unsigned char fill)
+{
+	set_pg_word(pg, PG_PTR_MASK | PG_FILL_FLAG, PG_FILL_FLAG | fill);
+}
+
+#ifndef USZRAM_NO_CACHING
+static inline struct cache_data pg_cache(const struct page *pg)
+{
+	struct cache_data cache;
+	const unsigned char bits = (pg_word(pg) & PG_CACHE_MASK)
+				   >> PG_CACHE_SHIFT;
+	memcpy(&cache, &bits, sizeof cache);
+	return cache;
+}
+
+static inline void set_pg_cache(struct page *pg, struct cache_data cache)
+{
+	unsigned char bits;
+	memcpy(&bits, &cache, sizeof cache);
+	uint_least64_t word = pg_word(pg), new;
+	do
+		new = (word & ~PG_CACHE_MASK)
+		      | (uint_least64_t)bits << PG_CACHE_SHIFT;
+	while (word != new
+	       && !atomic_compare_exchange_weak(&pg->word, &word, new));
+}
+#endif
+
+#endif
+
+/* pg_exists() returns whether any data is stored for pg. Its lock must be held;
+ * without it, use occ_test() (see uszram-occupancy.h).
+ */
+static inline _Bool pg_exists(const struct page *pg)
+{
+	unsigned char fill;
+	return pg_data(pg) || pg_fill(pg, &fill);
+}
+
 
 #endif // USZRAM_PAGE_H
@@ -0,0 +1,124 @@
+/* uszram-placement.h implements USZRAM_TABLE_HUGEPAGES, USZRAM_NUMA_INTERLEAVE,
+ * USZRAM_NUMA_NODE, and USZRAM_NUMA_SHARDS for the static page and lock tables.
+ * TABLE_ALIGNAS aligns a table to the size of a huge page, so that all of it
+ * can be backed by huge pages, place_table() applies the configured advice and
+ * memory policy to the whole pages of a table, and place_shards() gives each
+ * shard of a table its own node. A page of memory straddling two shards keeps
+ * the default policy. Tables are zero-initialized and so
+ * start out in .bss, which the kernel treats like any anonymous mapping.
+ *
+ * The memory policy only decides where pages go when they're first touched,
+ * so place_table() must be called before the table is initialized, and asks
+ * the kernel to move pages that were already touched (say, by an earlier
+ * uszram_init()). All of this is advice: if the kernel refuses, say because
+ * THP is disabled or there is only one node, the tables stay where they are.
+ * mbind() is called through syscall(), so libnuma isn't needed.
+ */
+
+#ifndef USZRAM_PLACEMENT_H
+#define USZRAM_PLACEMENT_H
+
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uszram-def.h"
+
+
+#if USZRAM_TABLE_HUGEPAGES
+#  define TABLE_ALIGNAS _Alignas(2097152)
+#else
+#  define TABLE_ALIGNAS
+#endif
+
+// From <linux/mempolicy.h>
+#define PLACE_MPOL_PREFERRED  1
+#define PLACE_MPOL_BIND       2
+#define PLACE_MPOL_INTERLEAVE 3
+#define PLACE_MPOL_MF_MOVE    (1 << 1)
+
+
+#ifdef SYS_mbind
+static inline long place_mbind(uintptr_t start, uintptr_t end, int mode,
+			       const unsigned long *nodes, unsigned long bits)
+{
+	// The kernel takes one less than the number of bits in the mask
+	return syscall(SYS_mbind, start, end - start, mode, nodes, bits + 1,
+		       PLACE_MPOL_MF_MOVE);
+}
+
+/* place_node() makes 'node' the node of the pages from start to end.
+ */
+static inline void place_node(uintptr_t start, uintptr_t end, int mode,
+			      unsigned node)
+{
+	unsigned long nodes[node / (8 * sizeof (long)) + 1];
+	memset(nodes, 0, sizeof nodes);
+	nodes[node / (8 * sizeof (long))] = 1ul << node % (8 * sizeof (long));
+	place_mbind(start, end, mode, nodes, 8 * sizeof nodes);
+}
+#endif
+
+/* place_round() rounds the range of 'size' bytes at 'mem' inward to whole pages
+ * of memory in *start and *end, returning whether any are left.
+ */
+static inline _Bool place_round(const void *mem, size_t size,
+				uintptr_t *start, uintptr_t *end)
+{
+	const uintptr_t page = sysconf(_SC_PAGESIZE);
+	*start = ((uintptr_t)mem + page - 1) / page * page;
+	*end = ((uintptr_t)mem + size) / page * page;
+	return *start < *end;
+}
+
+static void place_table(void *table, size_t size)
+{
+	uintptr_t start, end;
+	if (!place_round(table, size, &start, &end))
+		return;
+#if USZRAM_TABLE_HUGEPAGES && defined MADV_HUGEPAGE
+	madvise((void *)start, end - start, MADV_HUGEPAGE);
+#endif
+#if !defined SYS_mbind || USZRAM_NUMA_SHARDS
+	// Placed by place_shards() instead
+#elif USZRAM_NUMA_INTERLEAVE
+	// The kernel leaves out the nodes the process may not use, but fails
+	// if the mask has bits beyond the most nodes it supports
+	for (unsigned bits = 8 * sizeof (long); bits != 0; bits /= 2) {
+		unsigned long nodes = ~0ul >> (8 * sizeof (long) - bits);
+		if (place_mbind(start, end, PLACE_MPOL_INTERLEAVE, &nodes,
+				bits) == 0 || errno != EINVAL)
+			break;
+	}
+#elif USZRAM_NUMA_NODE >= 0
+	place_node(start, end, PLACE_MPOL_BIND, USZRAM_NUMA_NODE);
+#endif
+}
+
+#if USZRAM_NUMA_SHARDS
+/* place_shards() prefers node i for shard i of 'table', a table of 'count'
+ * entries of 'size' bytes, in shards of 'per_shard' entries. Preferring a node
+ * rather than binding to it lets the kernel fall back to other nodes if it
+ * runs out of memory, or if the node doesn't exist.
+ */
+static void place_shards(void *table, size_t size, uint_least64_t count,
+			 uint_least64_t per_shard)
+{
+	for (unsigned i = 0; (uint_least64_t)i * per_shard < count; ++i) {
+		const uint_least64_t first = (uint_least64_t)i * per_shard,
+				     last = count - first < per_shard
+					    ? count : first + per_shard;
+		uintptr_t start, end;
+		if (place_round((char *)table + first * size,
+				(last - first) * size, &start, &end))
+			place_node(start, end, PLACE_MPOL_PREFERRED, i);
+	}
+}
+#endif
+
+
+#endif // USZRAM_PLACEMENT_H
@@ -0,0 +1,47 @@
+/* uszram-probes.h defines PROBE(name, ...), which places a USDT (user-level
+ * statically defined tracing) probe uszram:name with up to 4 integer arguments,
+ * so that bpftrace, perf, SystemTap, etc. can trace a running program without
+ * rebuilding it, e.g.,
+ *	bpftrace -e 'usdt:./prog:uszram:huge_enter { @[arg0] = count(); }'
+ * Until a tracer attaches, a probe is a nop and its arguments are merely
+ * computed. Where <sys/sdt.h> (from SystemTap) isn't available, probes compile
+ * to nothing.
+ *
+ * The probes in uszram.c are
+ * - read_pg_entry, write_pg_entry: page address
+ * - read_blk_entry, write_blk_entry, delete_blk_entry: page address, offset
+ *   and count of the blocks within the page
+ * - *_return of the above: page address, compressed size after the operation,
+ *   and for reads, the result (negative if decompression failed)
+ * - write_helper_entry: page address
+ * - write_helper_return: page address, compressed size (0 if same-filled,
+ *   the page size if huge)
+ * - alloc_entry: page address, old size, new size
+ * - alloc_return: page address, change in heap bytes
+ * - huge_enter: page address
+ * - huge_leave: page address, new compressed size
+ */
+
+#ifndef USZRAM_PROBES_H
+#define USZRAM_PROBES_H
+
+
+#if defined __has_include
+#  if __has_include(<sys/sdt.h>)
+#    include <sys/sdt.h>
+#    define USZRAM_HAVE_SDT
+#  endif
+#endif
+
+#ifdef USZRAM_HAVE_SDT
+#  define PROBE_PICK(_0, _1, _2, _3, _4, probe, ...) probe
+#  define PROBE(...)							\
+	PROBE_PICK(__VA_ARGS__, DTRACE_PROBE4, DTRACE_PROBE3,		\
+		   DTRACE_PROBE2, DTRACE_PROBE1, DTRACE_PROBE)		\
+		(uszram, __VA_ARGS__)
+#else
+#  define PROBE(...) ((void)0)
+#endif
+
+
+#endif // USZRAM_PROBES_H
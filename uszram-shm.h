@@ -0,0 +1,85 @@
+/* uszram-shm.h describes the shared memory segment of USZRAM_SHM_STATS, both
+ * for uszram_publish_stats(), which writes it, and for monitors in other
+ * processes, like tools/shm-stat.c, which read it. A monitor must be compiled
+ * with the same uszram.h as the store, which uszram_shm_check() verifies as far
+ * as the layout goes.
+ *
+ * The segment is protected by a sequence lock: the publisher makes seq odd,
+ * writes the data, and makes seq even again, so a reader that sees the same
+ * even seq before and after copying the data has a consistent copy, and
+ * otherwise retries. Readers never write the segment, so they can map it read
+ * only and can't slow the store down.
+ */
+
+#ifndef USZRAM_SHM_H
+#define USZRAM_SHM_H
+
+
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "uszram.h"
+
+
+#define USZRAM_SHM_MAGIC   UINT32_C(0x7573737a)
+#define USZRAM_SHM_VERSION 2u
+#define USZRAM_SHM_REGIONS 64u
+#define USZRAM_SHM_PG_PER_REGION					\
+	((USZRAM_PAGE_COUNT - 1) / USZRAM_SHM_REGIONS + 1)
+
+
+/* Usage of one of USZRAM_SHM_REGIONS equal ranges of page addresses.
+ */
+struct uszram_shm_region {
+	uint_least64_t  pages_stored,
+			compr_bytes;	// Sum of the compressed page sizes
+};
+
+struct uszram_shm {
+	atomic_uint_least32_t     magic,	// USZRAM_SHM_MAGIC once set up
+				  seq;
+	uint_least32_t            version,	// USZRAM_SHM_VERSION
+				  size;		// sizeof (struct uszram_shm)
+	uint_least64_t            page_count,	// USZRAM_PAGE_COUNT
+				  published,	// # of publications
+				  time_ns;	// Of the last, since the epoch
+	struct uszram_stats       stats;
+	// p50, p99, and p99.9 as from uszram_latency()
+	uint_least64_t            latency[USZRAM_LAT_COUNT][3];
+	struct uszram_shm_region  regions[USZRAM_SHM_REGIONS];
+};
+
+/* uszram_shm_check() returns whether shm was set up by a store with the same
+ * layout.
+ */
+static inline _Bool uszram_shm_check(const struct uszram_shm *shm)
+{
+	return shm->magic == USZRAM_SHM_MAGIC
+	       && shm->version == USZRAM_SHM_VERSION
+	       && shm->size == sizeof *shm
+	       && shm->page_count == USZRAM_PAGE_COUNT;
+}
+
+/* uszram_shm_read() copies a consistent snapshot of shm into *copy.
+ */
+static inline void uszram_shm_read(const struct uszram_shm *shm,
+				   struct uszram_shm *copy)
+{
+	for (;;) {
+		const uint_least32_t seq = atomic_load_explicit(
+			&shm->seq, memory_order_acquire);
+		if (seq % 2 == 0) {
+			memcpy(copy, shm, sizeof *copy);
+			atomic_thread_fence(memory_order_acquire);
+			if (atomic_load_explicit(&shm->seq,
+						 memory_order_relaxed) == seq)
+				return;
+		}
+		sched_yield();
+	}
+}
+
+
+#endif // USZRAM_SHM_H
@@ -0,0 +1,88 @@
+/* uszram-workers.h implements USZRAM_SETUP_THREADS. run_workers() splits the
+ * lock stripes into up to USZRAM_SETUP_THREADS ranges of consecutive stripes
+ * and calls fn(lk_first, lk_last) for each in a thread of its own, the calling
+ * thread taking the last range, and returns once all of them are done. Ranges
+ * are whole stripes, so workers never touch each other's pages or write
+ * buffers, and with a fixed lock table, never wait for each other's locks. With
+ * USZRAM_DYNAMIC_LOCKS, stripes of different ranges may hash to the same lock,
+ * so workers that take locks can wait for each other briefly. A range whose
+ * thread can't be created is done by the calling thread instead.
+ */
+
+#ifndef USZRAM_WORKERS_H
+#define USZRAM_WORKERS_H
+
+
+#include <stdint.h>
+
+#include "uszram-def.h"
+
+#if USZRAM_SETUP_THREADS > 1
+#  ifdef USZRAM_STD_MTX
+#    include <threads.h>
+#    define THREAD_CREATE(thr, func, arg)				\
+	(thrd_create(thr, func, arg) != thrd_success)
+#    define THREAD_JOIN(thr) thrd_join(thr, NULL)
+     typedef thrd_t  thread_type;
+     typedef int     thread_ret;
+#  else
+#    include <pthread.h>
+#    define THREAD_CREATE(thr, func, arg) pthread_create(thr, NULL, func, arg)
+#    define THREAD_JOIN(thr) pthread_join(thr, NULL)
+     typedef pthread_t  thread_type;
+     typedef void      *thread_ret;
+#  endif
+#endif
+
+
+typedef void worker_fn(uint_least32_t lk_first, uint_least32_t lk_last);
+
+#if USZRAM_SETUP_THREADS > 1
+struct worker {
+	thread_type     thread;
+	worker_fn      *fn;
+	uint_least32_t  lk_first,
+			lk_last;
+	_Bool           started;
+};
+
+static thread_ret worker_main(void *arg)
+{
+	const struct worker *const w = arg;
+	w->fn(w->lk_first, w->lk_last);
+	return 0;
+}
+
+static void run_workers(worker_fn *fn)
+{
+	const uint_least32_t per = (LOCK_COUNT - 1) / USZRAM_SETUP_THREADS + 1;
+	struct worker workers[USZRAM_SETUP_THREADS];
+	unsigned n = 0;
+	for (uint_least32_t lk = 0; lk < LOCK_COUNT; lk += per, ++n) {
+		workers[n].fn = fn;
+		workers[n].lk_first = lk;
+		workers[n].lk_last = LOCK_COUNT - lk < per ? LOCK_COUNT
+							   : lk + per;
+		workers[n].started = 0;
+	}
+	for (unsigned i = 0; i + 1 < n; ++i)
+		workers[i].started = THREAD_CREATE(&workers[i].thread,
+						   worker_main,
+						   workers + i) == 0;
+	fn(workers[n - 1].lk_first, workers[n - 1].lk_last);
+	for (unsigned i = 0; i + 1 < n; ++i) {
+		if (workers[i].started)
+			THREAD_JOIN(workers[i].thread);
+		else
+			fn(workers[i].lk_first, workers[i].lk_last);
+	}
+}
+#else
+static inline void run_workers(worker_fn *fn)
+{
+	fn(0, LOCK_COUNT);
+}
+#endif
+
+
+#endif // USZRAM_WORKERS_H
@@ -1,3 +1,10 @@
+// clock_gettime() and ftruncate() aren't declared under -std=c11 without the
+// first, nor syscall() in locks/futex.h and uszram-placement.h without the
+// second
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <stddef.h>
 #include <string.h>
 #include <stdatomic.h>
 
@@ -15,35 +22,314 @@
 #  include "locks/uszram-pth-rw.h"
 #elif defined USZRAM_PTH_MTX
 #  include "locks/uszram-pth-mtx.h"
+#elif defined USZRAM_FUTEX_RW
+#  include "locks/uszram-futex-rw.h"
+#elif defined USZRAM_BRAVO
+#  include "locks/uszram-bravo.h"
 #else
 #  include "locks/uszram-std-mtx.h"
 #endif
 
+#if USZRAM_HOT_PG_BYTES
+#  include "caches/hot-pg-cache.h"
+#endif
+#if USZRAM_LOCK_PROFILE
+#  include "locks/lock-profile.h"
+#endif
+#if USZRAM_PARTITIONS
+#  include "locks/lock-partition.h"
+#endif
+#if USZRAM_DYNAMIC_LOCKS
+#  include "locks/lock-table.h"
+#endif
+#if USZRAM_LATENCY_SAMPLE
+#  include "uszram-latency.h"
+#endif
+#include "uszram-probes.h"
+#include "uszram-occupancy.h"
+#include "uszram-workers.h"
+#if USZRAM_FLAT_COMBINING
+#  include "uszram-combine.h"
+#endif
+#if USZRAM_FINGERPRINTS
+#  include "uszram-fingerprint.h"
+#endif
+#if USZRAM_TABLE_HUGEPAGES || USZRAM_NUMA_INTERLEAVE || USZRAM_NUMA_NODE >= 0 \
+    || USZRAM_NUMA_SHARDS
+#  include "uszram-placement.h"
+#else
+#  define TABLE_ALIGNAS
+#endif
+#if USZRAM_SHM_STATS
+#  include <time.h>
+#  include <sched.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include "uszram-shm.h"
+#endif
+
 
 static atomic_bool initialized;
-static struct page pgtbl[USZRAM_PAGE_COUNT];
-static struct lock lktbl[LOCK_COUNT];
-static struct {
+#if USZRAM_NUMA_SHARDS
+#  define SHARD_LOCKS ((LOCK_COUNT - 1) / USZRAM_NUMA_SHARDS + 1)
+#endif
+
+
+static TABLE_ALIGNAS struct page pgtbl[USZRAM_PAGE_COUNT];
+#if !USZRAM_DYNAMIC_LOCKS
+static TABLE_ALIGNAS struct lock lktbl[LOCK_COUNT];
+#endif
+
+#if USZRAM_LOCK_PROFILE || USZRAM_PARTITIONS
+/* stripe_of() returns the lock stripe controlled by 'lock', or with
+ * USZRAM_DYNAMIC_LOCKS, its index in the lock table.
+ */
+static uint_least32_t stripe_of(const struct lock *lock)
+{
+#if USZRAM_DYNAMIC_LOCKS
+	return lktbl_index(lock);
+#else
+	return lock - lktbl;
+#endif
+}
+#endif
+
+#if USZRAM_LOCK_PROFILE
+static uint_least32_t prof_index(const struct lock *lock)
+{
+	return stripe_of(lock);
+}
+#endif
+
+#if USZRAM_PARTITIONS
+static unsigned part_of(const struct lock *lock)
+{
+	return stripe_of(lock) / PART_LOCKS;
+}
+#endif
+
+/* The statistics are split into STAT_SHARDS shards, each on its own cache line,
+ * so that threads updating them don't fight over a single line. Each thread
+ * updates one shard (see stat_shard()), and reading a statistic sums it over
+ * all shards. Since the sum wraps like the counters, a shard's count can go
+ * "negative", e.g., when a page is stored by one thread and deleted by another.
+ */
+#define STAT_SHARDS 64u
+#define STAT_ALIGN  64u
+
+struct stats {
+	_Alignas(STAT_ALIGN)
 	atomic_uint_least64_t  compr_data_size,	// Total heap data except locks
 			       pages_stored,	// # of pages currently stored
 			       huge_pages,	// # of huge pages
 			       num_compr,	// # of compression attempts
-			       failed_compr;	// Attempts resulting in huge pages
-} stats;
+			       failed_compr,	// Attempts resulting in huge pages
+			       pg_writes,	// See struct uszram_stats
+			       elided_writes,
+			       bytes_read,
+			       bytes_decompressed;
+};
+
+static struct stats stats[STAT_SHARDS];
+static atomic_uint stat_next;
+static _Thread_local struct stats *stat_mine;
+
+/* stat_shard() returns the calling thread's shard, assigning shards to threads
+ * round-robin.
+ */
+static inline struct stats *stat_shard(void)
+{
+	if (stat_mine == NULL)
+		stat_mine = stats + atomic_fetch_add_explicit(
+			&stat_next, 1, memory_order_relaxed) % STAT_SHARDS;
+	return stat_mine;
+}
+
+static uint_least64_t stat_sum(size_t offset)
+{
+	uint_least64_t sum = 0;
+	for (unsigned i = 0; i < STAT_SHARDS; ++i)
+		sum += atomic_load_explicit((atomic_uint_least64_t *)
+					    ((char *)(stats + i) + offset),
+					    memory_order_relaxed);
+	return sum;
+}
+
+static void stat_clear(size_t offset)
+{
+	for (unsigned i = 0; i < STAT_SHARDS; ++i)
+		atomic_store_explicit((atomic_uint_least64_t *)
+				      ((char *)(stats + i) + offset), 0,
+				      memory_order_relaxed);
+}
+
+#define STAT_ADD(field, n)						\
+	atomic_fetch_add_explicit(&stat_shard()->field,			\
+				  (uint_least64_t)(n), memory_order_relaxed)
+#define STAT_SUB(field, n)						\
+	atomic_fetch_sub_explicit(&stat_shard()->field,			\
+				  (uint_least64_t)(n), memory_order_relaxed)
+#define STAT_SUM(field)   stat_sum  (offsetof(struct stats, field))
+#define STAT_CLEAR(field) stat_clear(offsetof(struct stats, field))
+
+/* LAT_BEGIN() and LAT_PHASE() declare t as the start time of an operation or a
+ * phase of one, or 0 if it isn't sampled, and LAT_FINISH() and LAT_END() count
+ * its latency (see uszram-latency.h).
+ */
+#if USZRAM_LATENCY_SAMPLE
+#  define LAT_BEGIN(t)        const uint_least64_t t = lat_begin()
+#  define LAT_PHASE(t)        const uint_least64_t t = lat_phase()
+#  define LAT_FINISH(what, t) lat_finish(what, t)
+#  define LAT_END(what, t)    lat_end(what, t)
+#else
+#  define LAT_BEGIN(t)
+#  define LAT_PHASE(t)
+#  define LAT_FINISH(what, t)
+#  define LAT_END(what, t)
+#endif
+
+/* PART_ROUTE() returns the result of the operation on n pages or blocks (if
+ * blk) starting at 'first', routed by part_route() to the owners of their
+ * partitions, unless the calling thread can do all of it itself (see
+ * lock-partition.h). The remaining arguments initialize the struct part_msg.
+ */
+#if USZRAM_PARTITIONS
+#  define PART_ROUTE(blk, first, n, ...)				\
+	do								\
+		if (!part_enter(blk, first, n))				\
+			return part_route(blk,				\
+				(blk) ? BLOCK_SIZE : PAGE_SIZE,		\
+				(struct part_msg){.addr = (first),	\
+						  .count = (n),		\
+						  __VA_ARGS__});	\
+	while (0)
+#else
+#  define PART_ROUTE(blk, first, n, ...) ((void)0)
+#endif
+
+#if USZRAM_SHM_STATS
+static struct uszram_shm *shm;
+static atomic_flag shm_publishing = ATOMIC_FLAG_INIT;
+
+/* shm_create() creates and maps the shared memory segment. Returns -1 on
+ * failure, otherwise 0.
+ */
+static int shm_create(void)
+{
+	const int fd = shm_open(USZRAM_SHM_NAME, O_CREAT | O_RDWR, 0644);
+	if (fd == -1)
+		return -1;
+	void *const addr = ftruncate(fd, sizeof *shm) ? MAP_FAILED
+			   : mmap(NULL, sizeof *shm, PROT_READ | PROT_WRITE,
+				  MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		shm_unlink(USZRAM_SHM_NAME);
+		return -1;
+	}
+	shm = addr;
+	memset(shm, 0, sizeof *shm);
+	shm->version = USZRAM_SHM_VERSION;
+	shm->size = sizeof *shm;
+	shm->page_count = USZRAM_PAGE_COUNT;
+	// Readers check the magic number before anything else
+	atomic_store_explicit(&shm->magic, USZRAM_SHM_MAGIC,
+			      memory_order_release);
+	return 0;
+}
+
+static void shm_remove(void)
+{
+	while (atomic_flag_test_and_set(&shm_publishing))
+		sched_yield();
+	if (shm) {
+		munmap(shm, sizeof *shm);
+		shm_unlink(USZRAM_SHM_NAME);
+		shm = NULL;
+	}
+	atomic_flag_clear(&shm_publishing);
+}
+#endif
+
+/* get_lock() returns the lock controlling the pages in lock stripe lk_addr.
+ * With USZRAM_DYNAMIC_LOCKS, that can change unless the lock is held, so locks
+ * must be taken with lock_stripe().
+ */
+static inline struct lock *get_lock(uint_least32_t lk_addr)
+{
+#if USZRAM_DYNAMIC_LOCKS
+	return lktbl_get(lk_addr);
+#else
+	return lktbl + lk_addr;
+#endif
+}
+
+/* lock_stripe() takes the lock controlling lock stripe lk_addr and returns it.
+ */
+static inline struct lock *lock_stripe(uint_least32_t lk_addr, _Bool writer)
+{
+	LAT_PHASE(t);
+#if USZRAM_DYNAMIC_LOCKS
+	struct lock *const lk = lktbl_lock(lk_addr, writer);
+#else
+	struct lock *const lk = get_lock(lk_addr);
+	if (writer)
+		lock_as_writer(lk);
+	else
+		lock_as_reader(lk);
+#endif
+	LAT_END(USZRAM_LAT_LOCK, t);
+	return lk;
+}
+
+#if USZRAM_WBUF_PAGES
+struct wbuf {
+	uint_least32_t  pg_addr,		// Page held in the buffer
+			updates;		// # of updates since loading
+	char            data[PAGE_SIZE];	// The page in original order
+};
+
+static struct wbuf *_Atomic wbtbl[LOCK_COUNT];	// At most one per lock
+static atomic_uint_least32_t wbufs_used;
+#endif
+
+#if USZRAM_ATOMIC_RANGES
+/* A struct staged holds a page compressed by stage_pgs() until it's stored.
+ */
+struct staged {
+	size_type          size;	// 0 if compression failed
+#if USZRAM_FINGERPRINTS
+	uint_least32_t     fp;		// fingerprint() of the page
+	_Bool              unchanged;	// Left uncompressed; see stage_pgs()
+#endif
+#ifndef USZRAM_NO_CACHING
+	struct cache_data  cache;
+#endif
+	char               data[MAX_NON_HUGE];
+};
+#endif
 
 typedef struct PgLoop {
 	const uint_least32_t  pg_end,
+			      lk_first,
 			      lk_last;
 	uint_least32_t        lk_addr;
+	unsigned char         held;	// See batch_lock()
+#if USZRAM_ATOMIC_RANGES
+	struct staged        *staged;	// Next page to store, if any
+#endif
 } PgLoop;
 
 typedef struct BlkLoop {
 	const uint_least32_t  blk_end,
 			      pg_last,
+			      lk_first,
 			      lk_last;
 	uint_least32_t        pg_addr,
 			      lk_addr,
 			      pg_next;
+	unsigned char         held;	// See batch_lock()
 } BlkLoop;
 
 static inline PgLoop make_pgloop(uint_least32_t pg_addr,
@@ -52,6 +338,7 @@ static inline PgLoop make_pgloop(uint_least32_t pg_addr,
 	const uint_least32_t pg_end = pg_addr + pages;
 	return (PgLoop){
 		.pg_end = pg_end,
+		.lk_first = pg_addr / PG_PER_LOCK,
 		.lk_last = (pg_end - 1u) / PG_PER_LOCK,
 		.lk_addr = pg_addr / PG_PER_LOCK,
 	};
@@ -67,6 +354,7 @@ static inline BlkLoop make_blkloop(uint_least32_t blk_addr,
 	return (BlkLoop){
 		.blk_end = blk_end,
 		.pg_last = pg_last,
+		.lk_first = lk_addr,
 		.lk_last = pg_last / PG_PER_LOCK,
 		.pg_addr = pg_addr,
 		.lk_addr = lk_addr,
@@ -74,45 +362,204 @@ static inline BlkLoop make_blkloop(uint_least32_t blk_addr,
 	};
 }
 
+/* An operation on several pages controlled by the same lock takes the lock once
+ * for up to USZRAM_LOCK_BATCH of them. 'held' counts the pages handled since
+ * the lock was taken and is 0 if it isn't held. batch_unlock() releases the
+ * lock once the batch is full, and batch_release() releases it at the end of a
+ * lock stripe or of the operation. With USZRAM_ATOMIC_RANGES, range_lock()
+ * already holds the locks, so these do nothing.
+ */
+static inline struct lock *batch_lock(unsigned char held,
+				      uint_least32_t lk_addr, _Bool writer)
+{
+	if (held || USZRAM_ATOMIC_RANGES)
+		return get_lock(lk_addr);
+	return lock_stripe(lk_addr, writer);
+}
+
+static inline void batch_release(unsigned char *held, struct lock *lk,
+				 _Bool writer)
+{
+	if (*held == 0)
+		return;
+	*held = 0;
+	if (writer)
+		unlock_as_writer(lk);
+	else
+		unlock_as_reader(lk);
+}
+
+static inline void batch_unlock(unsigned char *held, struct lock *lk,
+				_Bool writer)
+{
+	if (USZRAM_ATOMIC_RANGES)
+		return;
+	if (++*held >= USZRAM_LOCK_BATCH)
+		batch_release(held, lk, writer);
+}
+
+#if USZRAM_ATOMIC_RANGES
+/* range_lock() takes the locks of stripes lk_first through lk_last in address
+ * order, so that operations on overlapping ranges can't deadlock.
+ */
+static void range_lock(uint_least32_t lk_first, uint_least32_t lk_last,
+		       _Bool writer)
+{
+	LAT_PHASE(t);
+	do
+		if (writer)
+			lock_as_writer(get_lock(lk_first));
+		else
+			lock_as_reader(get_lock(lk_first));
+	while (lk_first++ != lk_last);
+	LAT_END(USZRAM_LAT_LOCK, t);
+}
+
+static void range_unlock(uint_least32_t lk_first, uint_least32_t lk_last,
+			 _Bool writer)
+{
+	do
+		if (writer)
+			unlock_as_writer(get_lock(lk_first));
+		else
+			unlock_as_reader(get_lock(lk_first));
+	while (lk_first++ != lk_last);
+}
+#endif
+
+#if USZRAM_WBUF_PAGES
+static inline struct wbuf *wbuf_get(uint_least32_t pg_addr)
+{
+	struct wbuf *const wb = wbtbl[pg_addr / PG_PER_LOCK];
+	return wb && wb->pg_addr == pg_addr ? wb : NULL;
+}
+
+static void wbuf_free(uint_least32_t lk_addr)
+{
+	free(wbtbl[lk_addr]);
+	wbtbl[lk_addr] = NULL;
+	--wbufs_used;
+	STAT_SUB(compr_data_size, sizeof (struct wbuf));
+}
+
+static void wbuf_drop(uint_least32_t pg_addr)
+{
+	if (wbuf_get(pg_addr))
+		wbuf_free(pg_addr / PG_PER_LOCK);
+}
+#endif
+
+/* reallocate(), compress_pg(), and decompress_pg() wrap the allocator's
+ * maybe_reallocate() and the compressor's compress() and decompress() to time
+ * them, and the first two to keep the statistics.
+ */
+static inline void reallocate(struct page *pg, size_type new_size)
+{
+	const size_type old_size = get_size_primary(pg);
+	PROBE(alloc_entry, pg - pgtbl, old_size, new_size);
+	LAT_PHASE(t);
+	const int change = maybe_reallocate(pg, old_size, new_size);
+	LAT_END(USZRAM_LAT_ALLOC, t);
+	STAT_ADD(compr_data_size, change);
+	PROBE(alloc_return, pg - pgtbl, change);
+}
+
+static inline size_type compress_pg(const char src[static PAGE_SIZE],
+				    char dest[static MAX_NON_HUGE])
+{
+	LAT_PHASE(t);
+	const size_type size = compress(src, dest);
+	LAT_END(USZRAM_LAT_COMPRESS, t);
+	STAT_ADD(num_compr, 1);
+	return size;
+}
+
+static inline int decompress_pg(const struct page *pg, size_type bytes,
+				char dest[static PAGE_SIZE])
+{
+	LAT_PHASE(t);
+	const int ret = decompress(pg, bytes, dest);
+	LAT_END(USZRAM_LAT_DECOMPRESS, t);
+	return ret;
+}
+
 static void delete_pg(struct page *pg)
 {
-	if (pg->data == NULL)
+	if (!pg_exists(pg))
 		return;
+#if USZRAM_WBUF_PAGES
+	wbuf_drop(pg - pgtbl);
+#endif
+#if USZRAM_HOT_PG_BYTES
+	hot_invalidate(pg - pgtbl);
+#endif
+#if USZRAM_FINGERPRINTS
+	fp_forget(pg - pgtbl);
+#endif
 	CACHE_RESET(pg);
-	--stats.pages_stored;
+	STAT_SUB(pages_stored, 1);
+	occ_clear(pg - pgtbl);
 	if (is_huge(pg))
-		--stats.huge_pages;
-	else
-		stats.compr_data_size -= free_reachable(pg);
-	stats.compr_data_size += maybe_reallocate(pg, get_size_primary(pg), 0);
+		STAT_SUB(huge_pages, 1);
+	else if (pg_data(pg))
+		STAT_SUB(compr_data_size, free_reachable(pg));
+	reallocate(pg, 0);
 	write_compressed(pg, 0, NULL);
+#if USZRAM_PACKED_PAGE
+	set_pg_data(pg, NULL);	// Clears the same-fill flag
+#endif
 }
 
-static int read_pg(const PgLoop *l, uint_least32_t pg_addr,
+static int read_pg(PgLoop *l, uint_least32_t pg_addr,
 		   char data[static PAGE_SIZE])
 {
 	const struct page *pg = pgtbl + pg_addr;
-	struct lock *lk = lktbl + l->lk_addr;
+	struct lock *lk;
 	int ret = 0;
 
-	if (pg->data == NULL) {
+	PROBE(read_pg_entry, pg_addr);
+	if (!occ_test(pg_addr)) {
 		memset(data, 0, PAGE_SIZE);
+		PROBE(read_pg_return, pg_addr, 0, ret);
 		return ret;
 	}
 
-	lock_as_reader(lk);
-	if (is_huge(pg)) {
-		memcpy(data, pg->data, PAGE_SIZE);
+	lk = batch_lock(l->held, l->lk_addr, 0);
+#if USZRAM_WBUF_PAGES
+	const struct wbuf *const wb = wbuf_get(pg_addr);
+	if (wb) {
+		memcpy(data, wb->data, PAGE_SIZE);
+		PROBE(read_pg_return, pg_addr, get_size(pg), ret);
+		batch_unlock(&l->held, lk, 0);
+		return ret;
+	}
+#endif
+	unsigned char fill;
+	if (!pg_exists(pg)) {		// Deleted since it was checked
+		memset(data, 0, PAGE_SIZE);
+	} else if (pg_fill(pg, &fill)) {
+		memset(data, fill, PAGE_SIZE);
+	} else if (is_huge(pg)) {
+		memcpy(data, pg_data(pg), PAGE_SIZE);
+#if USZRAM_HOT_PG_BYTES
+	} else if (hot_read(pg_addr, BYRNG(0, PAGE_SIZE), data)) {
+#endif
 	} else {
-		ret = decompress(pg, PAGE_SIZE, data);
+		ret = decompress_pg(pg, PAGE_SIZE, data);
+		STAT_ADD(bytes_decompressed, PAGE_SIZE);
 		UNCACHE_PG(pg, data);
+#if USZRAM_HOT_PG_BYTES
+		if (ret == 0)
+			hot_insert(pg_addr, data);
+#endif
 	}
-	unlock_as_reader(lk);
+	PROBE(read_pg_return, pg_addr, get_size(pg), ret);
+	batch_unlock(&l->held, lk, 0);
 
 	return ret;
 }
 
-static int read_blk(const BlkLoop *l, BlkRange blk,
+static int read_blk(BlkLoop *l, BlkRange blk,
 		    char data[static BLOCK_SIZE])
 {
 	const ByteRange byte = {
@@ -120,24 +567,54 @@ static int read_blk(const BlkLoop *l, BlkRange blk,
 		.count  = blk.count  * BLOCK_SIZE,
 	};
 	struct page *pg = pgtbl + l->pg_addr;
-	struct lock *lk = lktbl + l->lk_addr;
+	struct lock *lk;
 	int ret = 0;
 
-	if (pg->data == NULL) {
+	PROBE(read_blk_entry, l->pg_addr, blk.offset, blk.count);
+	if (!occ_test(l->pg_addr)) {
 		memset(data, 0, byte.count);
+		PROBE(read_blk_return, l->pg_addr, 0, ret);
 		return ret;
 	}
 
-	lock_as_reader(lk);
-	if (is_huge(pg)) {
-		memcpy(data, pg->data + byte.offset, byte.count);
+	lk = batch_lock(l->held, l->lk_addr, 0);
+#if USZRAM_WBUF_PAGES
+	const struct wbuf *const wb = wbuf_get(l->pg_addr);
+	if (wb) {
+		memcpy(data, wb->data + byte.offset, byte.count);
+		CACHE_LOG_READ(pg, blk);
+		PROBE(read_blk_return, l->pg_addr, get_size(pg), ret);
+		batch_unlock(&l->held, lk, 0);
+		return ret;
+	}
+#endif
+	unsigned char fill;
+	if (!pg_exists(pg)) {		// Deleted since it was checked
+		memset(data, 0, byte.count);
+	} else if (pg_fill(pg, &fill)) {
+		memset(data, fill, byte.count);
+	} else if (is_huge(pg)) {
+		memcpy(data, pg_data(pg) + byte.offset, byte.count);
+#if USZRAM_HOT_PG_BYTES
+	} else if (hot_read(l->pg_addr, byte, data)) {
+		CACHE_LOG_READ(pg, blk);
+#endif
 	} else {
 		char raw_pg[PAGE_SIZE];
-		ret = decompress(pg, BYTES_NEEDED(pg, blk, byte), raw_pg);
+		const size_type needed = BYTES_NEEDED(pg, blk, byte);
+		ret = decompress_pg(pg, needed, raw_pg);
+		STAT_ADD(bytes_decompressed, needed);
 		CACHE_READ(pg, byte, raw_pg, data);
 		CACHE_LOG_READ(pg, blk);
+#if USZRAM_HOT_PG_BYTES
+		if (ret == 0 && needed == PAGE_SIZE) {
+			UNCACHE_PG(pg, raw_pg);
+			hot_insert(l->pg_addr, raw_pg);
+		}
+#endif
 	}
-	unlock_as_reader(lk);
+	PROBE(read_blk_return, l->pg_addr, get_size(pg), ret);
+	batch_unlock(&l->held, lk, 0);
 
 	return ret;
 }
@@ -147,82 +624,326 @@ static size_type write_pg_common(struct page *pg, size_type compr_size,
 				 const char raw_pg[static PAGE_SIZE])
 {
 	if (compr_size == 0) {
-		++stats.failed_compr;
+		STAT_ADD(failed_compr, 1);
 		compr_size = PAGE_SIZE;
-		if (is_huge(pg))
+		if (is_huge(pg)) {
+			if (raw_pg != pg_data(pg))
+				memcpy(pg_data(pg), raw_pg, PAGE_SIZE);
+			write_compressed(pg, compr_size, NULL);
 			return compr_size;
-		++stats.huge_pages;
+		}
+		STAT_ADD(huge_pages, 1);
+		PROBE(huge_enter, pg - pgtbl);
 		compr_pg = raw_pg;
 	} else if (is_huge(pg)) {
-		--stats.huge_pages;
+		STAT_SUB(huge_pages, 1);
+		PROBE(huge_leave, pg - pgtbl, compr_size);
 	}
-	stats.compr_data_size
-		+= maybe_reallocate(pg, get_size_primary(pg), compr_size);
+	reallocate(pg, compr_size);
 	write_compressed(pg, compr_size, compr_pg);
 	return compr_size;
 }
 
+#if USZRAM_PACKED_PAGE
+/* write_same() stores pg as same-filled, freeing any heap data, if every byte
+ * of raw_pg is the same. Returns whether it did.
+ */
+static _Bool write_same(struct page *pg, const char raw_pg[static PAGE_SIZE])
+{
+	if (memcmp(raw_pg, raw_pg + 1, PAGE_SIZE - 1))
+		return 0;
+	const unsigned char fill = raw_pg[0];	// raw_pg may be pg_data(pg)
+	if (is_huge(pg)) {
+		STAT_SUB(huge_pages, 1);
+		PROBE(huge_leave, pg - pgtbl, 0);
+	}
+	reallocate(pg, 0);
+	write_compressed(pg, 0, NULL);
+	CACHE_RESET(pg);
+	set_pg_fill(pg, fill);
+	return 1;
+}
+#endif
+
 static inline size_type write_helper(struct page *pg,
 				     const char raw_pg[static PAGE_SIZE])
 {
+	PROBE(write_helper_entry, pg - pgtbl);
+#if USZRAM_PACKED_PAGE
+	if (write_same(pg, raw_pg)) {
+		PROBE(write_helper_return, pg - pgtbl, 0);
+		return 0;
+	}
+#endif
 	char compr_pg[PAGE_SIZE];
-	const size_type new_size = compress(raw_pg, compr_pg);
-	++stats.num_compr;
-	return write_pg_common(pg, new_size, compr_pg, raw_pg);
+	size_type new_size = compress_pg(raw_pg, compr_pg);
+	new_size = write_pg_common(pg, new_size, compr_pg, raw_pg);
+	PROBE(write_helper_return, pg - pgtbl, new_size);
+	return new_size;
 }
 
-static size_type write_pg(const PgLoop *l, uint_least32_t pg_addr,
-			  const char data[static PAGE_SIZE])
+static size_type write_raw(struct page *pg,
+			   const char raw_pg[static PAGE_SIZE])
 {
-	struct page *pg = pgtbl + pg_addr;
-	struct lock *lk = lktbl + l->lk_addr;
 #ifndef USZRAM_NO_CACHING
 	char copy[PAGE_SIZE];
+	CACHE_RAW_PG_COPY(pg, raw_pg, copy);
+	const size_type new_size = write_helper(pg, copy);
+	if (new_size == PAGE_SIZE) {
+		UNCACHE_PG(pg, pg_data(pg));
+		CACHE_RESET(pg);
+	}
+	return new_size;
+#else
+	return write_helper(pg, raw_pg);
 #endif
+}
 
-	lock_as_writer(lk);
-	CACHE_PG_COPY(pg, data, copy);
-	stats.pages_stored += pg->data == NULL;
-	const size_type new_size = write_helper(pg, data);
-	unlock_as_writer(lk);
+#if USZRAM_ATOMIC_RANGES
+/* stage_pgs() compresses 'pages' pages from data, to be stored from pg_addr on,
+ * into a new array, as write_raw() would but without touching the page table,
+ * so that it can be done before taking any locks. Since a page's cache data
+ * can't be read without its lock, each page's cached blocks are chosen as for a
+ * newly stored page. With USZRAM_FINGERPRINTS, a page whose fingerprint matches
+ * the stored page's is left uncompressed, since its write will likely be
+ * elided; if the page changes before its lock is taken, write_pg() compresses
+ * it there instead. Returns NULL if out of memory.
+ */
+static struct staged *stage_pgs(uint_least32_t pg_addr, uint_least32_t pages,
+				const char *data)
+{
+	struct staged *const staged = calloc(pages, sizeof *staged);
+	if (staged == NULL)
+		return NULL;
+	for (struct staged *st = staged; st != staged + pages;
+	     ++st, ++pg_addr, data += PAGE_SIZE) {
+#if USZRAM_FINGERPRINTS
+		st->fp = fingerprint(data);
+		st->unchanged = fp_get(pg_addr) == st->fp;
+		if (st->unchanged)
+			continue;
+#else
+		(void)pg_addr;
+#endif
+#ifndef USZRAM_NO_CACHING
+		char copy[PAGE_SIZE];
+		cache_init(&st->cache);
+		cache_raw_pg_copy(&st->cache, data, copy);
+		st->size = compress_pg(copy, st->data);
+		if (st->size == 0)
+			cache_reset(&st->cache);
+#else
+		st->size = compress_pg(data, st->data);
+#endif
+	}
+	return staged;
+}
+
+/* write_staged() is like write_raw() for a page already compressed into st from
+ * raw_pg by stage_pgs().
+ */
+static size_type write_staged(struct page *pg, struct staged *st,
+			      const char raw_pg[static PAGE_SIZE])
+{
+#if USZRAM_PACKED_PAGE && !defined USZRAM_NO_CACHING
+	if (write_same(pg, raw_pg)) {
+		cache_reset(&st->cache);
+		return 0;
+	}
+#elif USZRAM_PACKED_PAGE
+	if (write_same(pg, raw_pg))
+		return 0;
+#endif
+	CACHE_RESET(pg);
+	SET_PG_CACHE(pg, st->cache);
+	return write_pg_common(pg, st->size, st->data, raw_pg);
+}
+#endif
+
+#if USZRAM_WBUF_PAGES
+static void wbuf_writeback(const struct wbuf *wb)
+{
+	struct page *pg = pgtbl + wb->pg_addr;
+	STAT_SUB(compr_data_size, free_reachable(pg));
+	write_raw(pg, wb->data);
+}
+
+/* wbuf_write() writes blk from data (or zeros if data is NULL) into the write
+ * buffer for the page at pg_addr, first loading the page into the buffer of
+ * its lock if necessary, and deletes the page if zeros leave it all zeros. The
+ * page must exist and not be huge, and its lock must be held as a writer.
+ * Returns 0 if no buffer was available, otherwise 1.
+ */
+static _Bool wbuf_write(uint_least32_t pg_addr, BlkRange blk, const char *data)
+{
+	const uint_least32_t lk_addr = pg_addr / PG_PER_LOCK;
+	const struct page *pg = pgtbl + pg_addr;
+	struct wbuf *wb = wbtbl[lk_addr];
+
+	if (wb == NULL) {
+		if (wbufs_used++ >= USZRAM_WBUF_PAGES) {
+			--wbufs_used;
+			return 0;
+		}
+		wb = malloc(sizeof *wb);
+		if (wb == NULL) {
+			--wbufs_used;
+			return 0;
+		}
+		wbtbl[lk_addr] = wb;
+		STAT_ADD(compr_data_size, sizeof *wb);
+	} else if (wb->pg_addr != pg_addr) {
+		wbuf_writeback(wb);
+	} else {
+		goto update;
+	}
+	if (decompress_pg(pg, PAGE_SIZE, wb->data)) {
+		wbuf_free(lk_addr);
+		return 0;
+	}
+	UNCACHE_PG(pg, wb->data);
+	wb->pg_addr = pg_addr;
+	wb->updates = 0;
+
+update:
+	if (data) {
+		memcpy(wb->data + blk.offset * BLOCK_SIZE, data,
+		       blk.count * BLOCK_SIZE);
+	} else {
+		memset(wb->data + blk.offset * BLOCK_SIZE, 0,
+		       blk.count * BLOCK_SIZE);
+		// Deleted down to zeros, so freed as by read_delete()
+		if (wb->data[0] == 0
+		    && memcmp(wb->data, wb->data + 1, PAGE_SIZE - 1) == 0) {
+			delete_pg(pgtbl + pg_addr);	// Frees wb
+			return 1;
+		}
+	}
+	wb->updates += blk.count;
+	if (wb->updates >= USZRAM_WBUF_WAIT) {
+		wbuf_writeback(wb);
+		wbuf_free(lk_addr);
+	}
+	return 1;
+}
+#endif
+
+#if USZRAM_FINGERPRINTS
+/* pg_equals() returns whether the page pg, which must exist, holds data.
+ */
+static _Bool pg_equals(const struct page *pg, const char data[static PAGE_SIZE])
+{
+	unsigned char fill;
+	if (pg_fill(pg, &fill))
+		return (unsigned char)data[0] == fill
+		       && memcmp(data, data + 1, PAGE_SIZE - 1) == 0;
+	if (is_huge(pg))
+		return memcmp(pg_data(pg), data, PAGE_SIZE) == 0;
+	char raw_pg[PAGE_SIZE];
+	if (decompress_pg(pg, PAGE_SIZE, raw_pg))
+		return 0;
+	UNCACHE_PG(pg, raw_pg);
+	return memcmp(raw_pg, data, PAGE_SIZE) == 0;
+}
+#endif
+
+static size_type write_pg(PgLoop *l, uint_least32_t pg_addr,
+			  const char data[static PAGE_SIZE])
+{
+	struct page *pg = pgtbl + pg_addr;
+	struct lock *lk;
+
+	PROBE(write_pg_entry, pg_addr);
+#if USZRAM_ATOMIC_RANGES
+	struct staged *st = l->staged ? l->staged++ : NULL;
+#endif
+#if USZRAM_FINGERPRINTS && USZRAM_ATOMIC_RANGES
+	const uint_least32_t fp = st ? st->fp : fingerprint(data);
+#elif USZRAM_FINGERPRINTS
+	const uint_least32_t fp = fingerprint(data);
+#endif
+	lk = batch_lock(l->held, l->lk_addr, 1);
+#if USZRAM_WBUF_PAGES
+	wbuf_drop(pg_addr);
+#endif
+#if USZRAM_FINGERPRINTS
+	// A dropped write buffer's updates cleared the fingerprint
+	if (fp_get(pg_addr) == fp && pg_equals(pg, data)) {
+		STAT_ADD(elided_writes, 1);
+#  if USZRAM_ATOMIC_RANGES && !defined USZRAM_NO_CACHING
+		// Stored unchanged since stage_pgs() chose the staged copy's
+		// cached blocks, which must be given up
+		if (st && !st->unchanged)
+			cache_reset(&st->cache);
+#  endif
+		PROBE(write_pg_return, pg_addr, get_size(pg));
+		batch_unlock(&l->held, lk, 1);
+		return get_size(pg);
+	}
+#endif
+#if USZRAM_HOT_PG_BYTES
+	hot_invalidate(pg_addr);
+#endif
+	if (!pg_exists(pg)) {
+		STAT_ADD(pages_stored, 1);
+		occ_set(pg_addr);
+	}
+#if USZRAM_ATOMIC_RANGES && USZRAM_FINGERPRINTS
+	if (st && st->unchanged)	// Changed since stage_pgs()
+		st = NULL;
+#endif
+#if USZRAM_ATOMIC_RANGES
+	const size_type new_size = st ? write_staged(pg, st, data)
+				      : write_raw(pg, data);
+#else
+	const size_type new_size = write_raw(pg, data);
+#endif
+#if USZRAM_FINGERPRINTS
+	fp_set(pg_addr, fp);
+#endif
+	PROBE(write_pg_return, pg_addr, get_size(pg));
+	batch_unlock(&l->held, lk, 1);
 
 	return new_size;
 }
 
-static int write_blk(const BlkLoop *l, BlkRange blk,
-		     const char data[static BLOCK_SIZE], const char *orig)
+/* write_blk_locked() does the work of write_blk() with the page's lock held.
+ */
+static int write_blk_locked(uint_least32_t pg_addr, BlkRange blk,
+			    const char data[static BLOCK_SIZE],
+			    const char *orig)
 {
 	const ByteRange byte = {
 		.offset = blk.offset * BLOCK_SIZE,
 		.count  = blk.count  * BLOCK_SIZE,
 	};
-	struct page *pg = pgtbl + l->pg_addr;
-	struct lock *lk = lktbl + l->lk_addr;
+	struct page *pg = pgtbl + pg_addr;
 	int ret = 0;
 
-	lock_as_writer(lk);
-	if (pg->data == NULL) {
-		++stats.pages_stored;
+#if USZRAM_HOT_PG_BYTES
+	hot_invalidate(pg_addr);
+#endif
+#if USZRAM_FINGERPRINTS
+	fp_forget(pg_addr);
+#endif
+	if (!pg_exists(pg)) {
+		STAT_ADD(pages_stored, 1);
+		occ_set(pg_addr);
 		char raw_pg[PAGE_SIZE] = {0};
 		memcpy(raw_pg + byte.offset, data, byte.count);
-		ret = write_helper(pg, raw_pg);
-		unlock_as_writer(lk);
-		return ret;
+		return write_helper(pg, raw_pg);
 	}
 
-	if (is_huge(pg)) {
-		memcpy(pg->data + byte.offset, data, byte.count);
-		if (needs_recompress(pg, blk.count)) {
-#ifndef USZRAM_NO_CACHING
-			char cached[PAGE_SIZE];
-			CACHE_PG_COPY(pg, pg->data, cached);
-#endif
-			ret = write_helper(pg, pg->data);
-#ifndef USZRAM_NO_CACHING
-			if (ret == PAGE_SIZE)
-				CACHE_RESET(pg);
-#endif
-		}
+	unsigned char fill;
+	if (pg_fill(pg, &fill)) {
+		char raw_pg[PAGE_SIZE];
+		memset(raw_pg, fill, PAGE_SIZE);
+		memcpy(raw_pg + byte.offset, data, byte.count);
+		ret = write_raw(pg, raw_pg);
+	} else if (is_huge(pg)) {
+		memcpy(pg_data(pg) + byte.offset, data, byte.count);
+		if (needs_recompress(pg, blk.count))
+			ret = write_raw(pg, pg_data(pg));
 	} else {
 #ifndef USZRAM_NO_CACHING
 		BlkRange ranges[MAX_PG_RANGES];
@@ -231,6 +952,10 @@ static int write_blk(const BlkLoop *l, BlkRange blk,
 #endif
 		char raw_pg[PAGE_SIZE];
 		const int old_size = get_size(pg);
+#if USZRAM_WBUF_PAGES
+		if (wbuf_write(pg_addr, blk, data))
+			return 0;
+#endif
 		const unsigned char
 			range_count = GET_PG_RANGES(pg, blk, ranges);
 		ret = orig
@@ -238,50 +963,190 @@ static int write_blk(const BlkLoop *l, BlkRange blk,
 					 orig)
 		      : read_modify(pg, range_count, ranges, raw_pg, data);
 		if (ret) {
-			stats.compr_data_size -= free_reachable(pg);
+			STAT_SUB(compr_data_size, free_reachable(pg));
 			CACHE_PG(pg, raw_pg);
 			ret = write_helper(pg, raw_pg);
 #ifndef USZRAM_NO_CACHING
 			if (ret == PAGE_SIZE) {
-				UNCACHE_PG(pg, pg->data);
+				UNCACHE_PG(pg, pg_data(pg));
 				CACHE_RESET(pg);
 			}
 #endif
 		} else {
-			stats.compr_data_size += (int)get_size(pg) - old_size;
+			STAT_ADD(compr_data_size, (int)get_size(pg) - old_size);
 		}
 	}
-	unlock_as_writer(lk);
 	return 0;
 }
 
-static int delete_blk(const BlkLoop *l, BlkRange blk)
+static int write_blk(BlkLoop *l, BlkRange blk,
+		     const char data[static BLOCK_SIZE], const char *orig)
+{
+	PROBE(write_blk_entry, l->pg_addr, blk.offset, blk.count);
+	struct lock *const lk = batch_lock(l->held, l->lk_addr, 1);
+	const int ret = write_blk_locked(l->pg_addr, blk, data, orig);
+	PROBE(write_blk_return, l->pg_addr, get_size(pgtbl + l->pg_addr));
+	batch_unlock(&l->held, lk, 1);
+	return ret;
+}
+
+#if USZRAM_FLAT_COMBINING
+/* combine_pg() does the requests in 'group', all for the page at pg_addr, whose
+ * lock must be held as a writer, and tells their writers. If there are several
+ * and the page is missing, filled, or compressed, it is loaded once, all of
+ * them are applied in order, and it is compressed once. Otherwise, as for huge
+ * pages, which are written in place, and pages in a write buffer, which already
+ * absorbs block writes, each request is done by write_blk_locked().
+ */
+static void combine_pg(uint_least32_t pg_addr, struct comb_req *group)
+{
+	struct page *pg = pgtbl + pg_addr;
+	const _Bool exists = pg_exists(pg);
+	char raw_pg[PAGE_SIZE];
+	unsigned char fill;
+
+	if (group->next == NULL)
+		goto one_by_one;
+#if USZRAM_WBUF_PAGES
+	if (wbuf_get(pg_addr))
+		goto one_by_one;
+#endif
+	if (!exists) {
+		memset(raw_pg, 0, PAGE_SIZE);
+	} else if (pg_fill(pg, &fill)) {
+		memset(raw_pg, fill, PAGE_SIZE);
+	} else if (is_huge(pg)) {
+		goto one_by_one;
+	} else {
+		if (decompress_pg(pg, PAGE_SIZE, raw_pg))
+			goto one_by_one;
+		UNCACHE_PG(pg, raw_pg);
+		STAT_SUB(compr_data_size, free_reachable(pg));
+	}
+
+	for (const struct comb_req *req = group; req; req = req->next)
+		memcpy(raw_pg + req->blk.offset * BLOCK_SIZE, req->data,
+		       req->blk.count * BLOCK_SIZE);
+#if USZRAM_HOT_PG_BYTES
+	hot_invalidate(pg_addr);
+#endif
+#if USZRAM_FINGERPRINTS
+	fp_forget(pg_addr);
+#endif
+	if (exists) {
+		write_raw(pg, raw_pg);
+	} else {
+		STAT_ADD(pages_stored, 1);
+		occ_set(pg_addr);
+		write_helper(pg, raw_pg);
+	}
+	while (group) {
+		struct comb_req *const next = group->next;
+		comb_done(group);
+		group = next;
+	}
+	return;
+
+one_by_one:
+	while (group) {
+		struct comb_req *const next = group->next;
+		write_blk_locked(pg_addr, group->blk, group->data, group->orig);
+		comb_done(group);
+		group = next;
+	}
+}
+
+/* combine_stripe() does every request in the queue of lock stripe lk_addr,
+ * whose lock must be held as a writer, a page at a time.
+ */
+static void combine_stripe(uint_least32_t lk_addr)
+{
+	struct comb_req *rest = comb_take(lk_addr);
+	while (rest) {
+		const uint_least32_t pg_addr = rest->pg_addr;
+		struct comb_req *group, **tail = &group, **link = &rest;
+		while (*link) {
+			struct comb_req *const req = *link;
+			if (req->pg_addr == pg_addr) {
+				*link = req->next;
+				*tail = req;
+				tail = &req->next;
+			} else {
+				link = &req->next;
+			}
+		}
+		*tail = NULL;
+		combine_pg(pg_addr, group);
+	}
+}
+
+/* combine_write() writes blk of the page at pg_addr from data, by combining it
+ * with other threads' writes to the same lock stripe.
+ */
+static void combine_write(uint_least32_t pg_addr, BlkRange blk,
+			  const char *data, const char *orig)
+{
+	const uint_least32_t lk_addr = pg_addr / PG_PER_LOCK;
+	struct comb_req req = {
+		.data    = data,
+		.orig    = orig,
+		.pg_addr = pg_addr,
+		.blk     = blk,
+	};
+
+	PROBE(write_blk_entry, pg_addr, blk.offset, blk.count);
+	comb_push(lk_addr, &req);
+	struct lock *const lk = lock_stripe(lk_addr, 1);
+	// Unless the last holder of the lock already did it
+	if (!comb_is_done(&req))
+		combine_stripe(lk_addr);
+	PROBE(write_blk_return, pg_addr, get_size(pgtbl + pg_addr));
+	unlock_as_writer(lk);
+}
+#endif
+
+static int delete_blk(BlkLoop *l, BlkRange blk)
 {
 	const ByteRange byte = {
 		.offset = blk.offset * BLOCK_SIZE,
 		.count  = blk.count  * BLOCK_SIZE,
 	};
 	struct page *pg = pgtbl + l->pg_addr;
-	struct lock *lk = lktbl + l->lk_addr;
+	struct lock *lk;
 	int ret = 0;
 
-	if (pg->data == NULL)
+	PROBE(delete_blk_entry, l->pg_addr, blk.offset, blk.count);
+	if (!occ_test(l->pg_addr)) {
+		PROBE(delete_blk_return, l->pg_addr, 0);
 		return ret;
+	}
 
-	lock_as_writer(lk);
-	if (is_huge(pg)) {
-		memset(pg->data + byte.offset, 0, byte.count);
-		if (needs_recompress(pg, blk.count)) {
-#ifndef USZRAM_NO_CACHING
-			char cached[PAGE_SIZE];
-			CACHE_PG_COPY(pg, pg->data, cached);
+	lk = batch_lock(l->held, l->lk_addr, 1);
+#if USZRAM_HOT_PG_BYTES
+	hot_invalidate(l->pg_addr);
 #endif
-			ret = write_helper(pg, pg->data);
-#ifndef USZRAM_NO_CACHING
-			if (ret == PAGE_SIZE)
-				CACHE_RESET(pg);
+#if USZRAM_FINGERPRINTS
+	fp_forget(l->pg_addr);
 #endif
+	unsigned char fill;
+	if (!pg_exists(pg)) {
+		// Deleted since it was checked
+	} else if (pg_fill(pg, &fill)) {
+		if (fill == 0 || byte.count == PAGE_SIZE) {
+			delete_pg(pg);		// Left all zeros
+		} else {
+			char raw_pg[PAGE_SIZE];
+			memset(raw_pg, fill, PAGE_SIZE);
+			memset(raw_pg + byte.offset, 0, byte.count);
+			ret = write_raw(pg, raw_pg);
 		}
+	} else if (is_huge(pg)) {
+		char *const raw_pg = pg_data(pg);
+		memset(raw_pg + byte.offset, 0, byte.count);
+		if (!raw_pg[0] && !memcmp(raw_pg, raw_pg + 1, PAGE_SIZE - 1))
+			delete_pg(pg);
+		else if (needs_recompress(pg, blk.count))
+			ret = write_raw(pg, raw_pg);
 	} else {
 #ifndef USZRAM_NO_CACHING
 		BlkRange ranges[MAX_PG_RANGES];
@@ -289,15 +1154,22 @@ static int delete_blk(const BlkLoop *l, BlkRange blk)
 		BlkRange *ranges = &blk;
 #endif
 		char raw_pg[PAGE_SIZE];
+#if USZRAM_WBUF_PAGES
+		if (wbuf_write(l->pg_addr, blk, NULL)) {
+			PROBE(delete_blk_return, l->pg_addr, get_size(pg));
+			batch_unlock(&l->held, lk, 1);
+			return ret;
+		}
+#endif
 		const unsigned char
 			range_count = GET_PG_RANGES(pg, blk, ranges);
 		if (read_delete(pg, range_count, ranges, raw_pg)) {
-			stats.compr_data_size -= free_reachable(pg);
+			STAT_SUB(compr_data_size, free_reachable(pg));
 			CACHE_PG(pg, raw_pg);
 			ret = write_helper(pg, raw_pg);
 #ifndef USZRAM_NO_CACHING
 			if (ret == PAGE_SIZE) {
-				UNCACHE_PG(pg, pg->data);
+				UNCACHE_PG(pg, pg_data(pg));
 				CACHE_RESET(pg);
 			}
 #endif
@@ -305,36 +1177,208 @@ static int delete_blk(const BlkLoop *l, BlkRange blk)
 			delete_pg(pg);
 		}
 	}
-	unlock_as_writer(lk);
+	PROBE(delete_blk_return, l->pg_addr, get_size(pg));
+	batch_unlock(&l->held, lk, 1);
 	return ret;
 }
 
-int uszram_delete_all(void)
+/* stripe_pg() returns the address of the first page of lock stripe lk_addr, or
+ * USZRAM_PAGE_COUNT if lk_addr is LOCK_COUNT.
+ */
+static inline uint_least64_t stripe_pg(uint_least32_t lk_addr)
 {
-	uint_least64_t pg_addr = 0;
-	uint_least32_t pg_next = 0, lk_addr = 0, lk_last = LOCK_COUNT - 1;
-	for (; lk_addr != lk_last; ++lk_addr) {
-		pg_next += PG_PER_LOCK;
-		lock_as_writer(lktbl + lk_addr);
-		for (; pg_addr != pg_next; ++pg_addr)
+	const uint_least64_t pg_addr = (uint_least64_t)lk_addr * PG_PER_LOCK;
+	return pg_addr < USZRAM_PAGE_COUNT ? pg_addr : USZRAM_PAGE_COUNT;
+}
+
+static void delete_stripes(uint_least32_t lk_first, uint_least32_t lk_last)
+{
+	const uint_least64_t pg_last = stripe_pg(lk_last);
+	uint_least64_t pg_addr = occ_next(stripe_pg(lk_first));
+	while (pg_addr < pg_last) {
+		const uint_least32_t lk_addr = pg_addr / PG_PER_LOCK;
+		const uint_least64_t pg_next = stripe_pg(lk_addr + 1);
+		struct lock *const lk = lock_stripe(lk_addr, 1);
+		// The stripe's bits can't change now that we hold its lock
+		for (; pg_addr < pg_next; pg_addr = occ_next(pg_addr + 1))
 			delete_pg(pgtbl + pg_addr);
-		unlock_as_writer(lktbl + lk_addr);
+		unlock_as_writer(lk);
+		pg_addr = occ_next(pg_next);
+	}
+}
+
+#if USZRAM_WBUF_PAGES
+static void flush_stripes(uint_least32_t lk_first, uint_least32_t lk_last)
+{
+	for (uint_least32_t i = lk_first; i != lk_last; ++i) {
+		if (wbtbl[i] == NULL)
+			continue;
+		struct lock *const lk = lock_stripe(i, 1);
+		if (wbtbl[i]) {
+			wbuf_writeback(wbtbl[i]);
+			wbuf_free(i);
+		}
+		unlock_as_writer(lk);
 	}
-	lock_as_writer(lktbl + lk_addr);
-	for (; pg_addr != USZRAM_PAGE_COUNT; ++pg_addr)
-		delete_pg(pgtbl + pg_addr);
-	unlock_as_writer(lktbl + lk_addr);
+}
+#endif
+
+#if USZRAM_PARTITIONS
+/* The functions below run a request forwarded to the owner of a partition.
+ * stripes_msg() runs the worker_fn pointed to by msg->arg on the stripes of
+ * the pages of msg, which part_route() splits at stripe boundaries.
+ */
+static int stripes_msg(const struct part_msg *msg)
+{
+	worker_fn *const *const fn = msg->arg;
+	(*fn)(msg->addr / PG_PER_LOCK,
+	      ((uint_least64_t)msg->addr + msg->count - 1) / PG_PER_LOCK + 1);
 	return 0;
 }
 
+/* route_stripes() runs fn on the stripes of every partition, each as its
+ * owner.
+ */
+static void route_stripes(worker_fn *fn)
+{
+	part_route(0, 0, (struct part_msg){.fn = stripes_msg,
+					   .count = USZRAM_PAGE_COUNT,
+					   .arg = &fn});
+}
+
+static int read_pg_msg(const struct part_msg *msg)
+{
+	return uszram_read_pg(msg->addr, msg->count, msg->out);
+}
+
+static int read_blk_msg(const struct part_msg *msg)
+{
+	return uszram_read_blk(msg->addr, msg->count, msg->out);
+}
+
+static int write_pg_msg(const struct part_msg *msg)
+{
+	return uszram_write_pg(msg->addr, msg->count, msg->in);
+}
+
+static int write_blk_msg(const struct part_msg *msg)
+{
+	return uszram_write_blk_hint(msg->addr, msg->count, msg->in,
+				     msg->orig);
+}
+
+static int delete_pg_msg(const struct part_msg *msg)
+{
+	return uszram_delete_pg(msg->addr, msg->count);
+}
+
+static int delete_blk_msg(const struct part_msg *msg)
+{
+	return uszram_delete_blk(msg->addr, msg->count);
+}
+
+static int pg_is_huge_msg(const struct part_msg *msg)
+{
+	return uszram_pg_is_huge(msg->addr);
+}
+
+static int pg_heap_msg(const struct part_msg *msg)
+{
+	return uszram_pg_heap(msg->addr);
+}
+#endif
+
+int uszram_delete_all(void)
+{
+#if USZRAM_PARTITIONS
+	route_stripes(delete_stripes);
+#else
+	run_workers(delete_stripes);
+#endif
+	return 0;
+}
+
+int uszram_flush(void)
+{
+#if USZRAM_WBUF_PAGES && USZRAM_PARTITIONS
+	route_stripes(flush_stripes);
+#elif USZRAM_WBUF_PAGES
+	flush_stripes(0, LOCK_COUNT);
+#endif
+	return 0;
+}
+
+uint_least64_t uszram_lock_count(void)
+{
+#if USZRAM_DYNAMIC_LOCKS
+	return (uint_least64_t)1 << lktbl_current->bits;
+#else
+	return LOCK_COUNT;
+#endif
+}
+
+int uszram_resize_locks(uint_least64_t locks)
+{
+#if USZRAM_DYNAMIC_LOCKS
+	const unsigned char max_bits = lktbl_max_bits();
+	unsigned char bits = LKTBL_MIN_BITS;
+	while (bits < max_bits && (uint_least64_t)1 << bits < locks)
+		++bits;
+	return lktbl_resize(bits, 1);
+#else
+	(void)locks;
+	return -1;
+#endif
+}
+
+static void init_stripes(uint_least32_t lk_first, uint_least32_t lk_last)
+{
+#if !USZRAM_DYNAMIC_LOCKS
+	for (uint_least32_t i = lk_first; i != lk_last; ++i)
+		initialize_lock(get_lock(i));
+#endif
+	const uint_least64_t pg_last = stripe_pg(lk_last);
+	for (uint_least64_t i = stripe_pg(lk_first); i != pg_last; ++i)
+		CACHE_INIT(pgtbl + i);
+}
+
+static void exit_stripes(uint_least32_t lk_first, uint_least32_t lk_last)
+{
+#if !USZRAM_DYNAMIC_LOCKS
+	for (uint_least32_t i = lk_first; i != lk_last; ++i)
+		destroy_lock(get_lock(i));
+#endif
+	const uint_least64_t pg_last = stripe_pg(lk_last);
+	for (uint_least64_t i = occ_next(stripe_pg(lk_first)); i < pg_last;
+	     i = occ_next(i + 1))
+		delete_pg(pgtbl + i);
+}
+
 int uszram_init(void)
 {
 	if (initialized)
 		return -1;
-	for (uint_least64_t i = 0; i != LOCK_COUNT; ++i)
-		initialize_lock(lktbl + i);
-	for (uint_least64_t i = 0; i != USZRAM_PAGE_COUNT; ++i)
-		CACHE_INIT(pgtbl + i);
+#if USZRAM_TABLE_HUGEPAGES || USZRAM_NUMA_INTERLEAVE || USZRAM_NUMA_NODE >= 0 \
+    || USZRAM_NUMA_SHARDS
+	place_table(pgtbl, sizeof pgtbl);
+#  if !USZRAM_DYNAMIC_LOCKS
+	place_table(lktbl, sizeof lktbl);
+#  endif
+#endif
+#if USZRAM_NUMA_SHARDS
+	place_shards(pgtbl, sizeof *pgtbl, USZRAM_PAGE_COUNT,
+		     (uint_least64_t)SHARD_LOCKS * PG_PER_LOCK);
+#  if !USZRAM_DYNAMIC_LOCKS
+	place_shards(lktbl, sizeof *lktbl, LOCK_COUNT, SHARD_LOCKS);
+#  endif
+#endif
+#if USZRAM_DYNAMIC_LOCKS
+	lktbl_init();
+#endif
+#if USZRAM_HOT_PG_BYTES
+	hot_init();
+#endif
+	run_workers(init_stripes);
 	initialized = 1;
 	return 0;
 }
@@ -344,11 +1388,32 @@ int uszram_exit(void)
 	if (!initialized)
 		return -1;
 	initialized = 0;
-	for (uint_least64_t i = 0; i != LOCK_COUNT; ++i)
-		destroy_lock(lktbl + i);
-	for (uint_least64_t i = 0; i != USZRAM_PAGE_COUNT; ++i)
-		delete_pg(pgtbl + i);
-	stats.num_compr = stats.failed_compr = 0;
+#if USZRAM_DYNAMIC_LOCKS
+	lktbl_exit();
+#endif
+	run_workers(exit_stripes);
+	CACHE_EXIT();
+#if USZRAM_HOT_PG_BYTES
+	hot_exit();
+#endif
+	STAT_CLEAR(num_compr);
+	STAT_CLEAR(failed_compr);
+	STAT_CLEAR(pg_writes);
+	STAT_CLEAR(elided_writes);
+	STAT_CLEAR(bytes_read);
+	STAT_CLEAR(bytes_decompressed);
+#if USZRAM_LATENCY_SAMPLE
+	lat_clear();
+#endif
+#if USZRAM_LOCK_PROFILE
+	prof_clear();
+#endif
+#if USZRAM_SHM_STATS
+	shm_remove();
+#endif
+#if USZRAM_PARTITIONS
+	part_clear();
+#endif
 	return 0;
 }
 
@@ -358,8 +1423,14 @@ int uszram_read_pg(uint_least32_t pg_addr, uint_least32_t pages, char *data)
 		return 0;
 	if ((uint_least64_t)pg_addr + pages > USZRAM_PAGE_COUNT)
 		return -1;
+	PART_ROUTE(0, pg_addr, pages, .fn = read_pg_msg, .out = data);
 
 	PgLoop l = make_pgloop(pg_addr, pages);
+	LAT_BEGIN(lat_start);
+	STAT_ADD(bytes_read, (uint_least64_t)pages * PAGE_SIZE);
+#if USZRAM_ATOMIC_RANGES
+	range_lock(l.lk_first, l.lk_last, 0);
+#endif
 	pages = l.lk_addr * PG_PER_LOCK;
 	for (; l.lk_addr != l.lk_last; ++l.lk_addr) {
 		pages += PG_PER_LOCK;
@@ -367,11 +1438,17 @@ int uszram_read_pg(uint_least32_t pg_addr, uint_least32_t pages, char *data)
 			read_pg(&l, pg_addr, data);
 			data += PAGE_SIZE;
 		}
+		batch_release(&l.held, get_lock(l.lk_addr), 0);
 	}
 	for (; pg_addr != l.pg_end; ++pg_addr) {
 		read_pg(&l, pg_addr, data);
 		data += PAGE_SIZE;
 	}
+	batch_release(&l.held, get_lock(l.lk_addr), 0);
+#if USZRAM_ATOMIC_RANGES
+	range_unlock(l.lk_first, l.lk_last, 0);
+#endif
+	LAT_FINISH(USZRAM_LAT_READ_PG, lat_start);
 
 	return 0;
 }
@@ -382,8 +1459,14 @@ int uszram_read_blk(uint_least32_t blk_addr, uint_least32_t blocks, char *data)
 		return 0;
 	if ((uint_least64_t)blk_addr + blocks > USZRAM_BLOCK_COUNT)
 		return -1;
+	PART_ROUTE(1, blk_addr, blocks, .fn = read_blk_msg, .out = data);
 
 	BlkLoop l = make_blkloop(blk_addr, blocks);
+	LAT_BEGIN(lat_start);
+	STAT_ADD(bytes_read, (uint_least64_t)blocks * BLOCK_SIZE);
+#if USZRAM_ATOMIC_RANGES
+	range_lock(l.lk_first, l.lk_last, 0);
+#endif
 	if (l.pg_addr != l.pg_last) {
 		const size_type offset = blk_addr % BLK_PER_PG;
 		const BlkRange blk = BLRNG(offset, BLK_PER_PG - offset);
@@ -399,6 +1482,7 @@ int uszram_read_blk(uint_least32_t blk_addr, uint_least32_t blocks, char *data)
 			data += PAGE_SIZE;
 			blk_addr += BLK_PER_PG;
 		}
+		batch_release(&l.held, get_lock(l.lk_addr), 0);
 	}
 	for (; l.pg_addr != l.pg_last; ++l.pg_addr) {
 		read_blk(&l, BLRNG(0, BLK_PER_PG), data);
@@ -406,6 +1490,11 @@ int uszram_read_blk(uint_least32_t blk_addr, uint_least32_t blocks, char *data)
 		blk_addr += BLK_PER_PG;
 	}
 	read_blk(&l, BLRNG(blk_addr % BLK_PER_PG, l.blk_end - blk_addr), data);
+	batch_release(&l.held, get_lock(l.lk_addr), 0);
+#if USZRAM_ATOMIC_RANGES
+	range_unlock(l.lk_first, l.lk_last, 0);
+#endif
+	LAT_FINISH(USZRAM_LAT_READ_BLK, lat_start);
 
 	return 0;
 }
@@ -417,8 +1506,16 @@ int uszram_write_pg(uint_least32_t pg_addr, uint_least32_t pages,
 		return 0;
 	if ((uint_least64_t)pg_addr + pages > USZRAM_PAGE_COUNT)
 		return -1;
+	PART_ROUTE(0, pg_addr, pages, .fn = write_pg_msg, .in = data);
 
 	PgLoop l = make_pgloop(pg_addr, pages);
+	LAT_BEGIN(lat_start);
+	STAT_ADD(pg_writes, pages);
+#if USZRAM_ATOMIC_RANGES
+	struct staged *const staged = stage_pgs(pg_addr, pages, data);
+	l.staged = staged;
+	range_lock(l.lk_first, l.lk_last, 1);
+#endif
 	pages = l.lk_addr * PG_PER_LOCK;
 	for (; l.lk_addr != l.lk_last; ++l.lk_addr) {
 		pages += PG_PER_LOCK;
@@ -426,11 +1523,18 @@ int uszram_write_pg(uint_least32_t pg_addr, uint_least32_t pages,
 			write_pg(&l, pg_addr, data);
 			data += PAGE_SIZE;
 		}
+		batch_release(&l.held, get_lock(l.lk_addr), 1);
 	}
 	for (; pg_addr != l.pg_end; ++pg_addr) {
 		write_pg(&l, pg_addr, data);
 		data += PAGE_SIZE;
 	}
+	batch_release(&l.held, get_lock(l.lk_addr), 1);
+#if USZRAM_ATOMIC_RANGES
+	range_unlock(l.lk_first, l.lk_last, 1);
+	free(staged);
+#endif
+	LAT_FINISH(USZRAM_LAT_WRITE_PG, lat_start);
 
 	return 0;
 }
@@ -442,8 +1546,23 @@ int uszram_write_blk_hint(uint_least32_t blk_addr, uint_least32_t blocks,
 		return 0;
 	if ((uint_least64_t)blk_addr + blocks > USZRAM_BLOCK_COUNT)
 		return -1;
+	PART_ROUTE(1, blk_addr, blocks, .fn = write_blk_msg, .in = data,
+		   .orig = orig);
 
 	BlkLoop l = make_blkloop(blk_addr, blocks);
+	LAT_BEGIN(lat_start);
+	STAT_ADD(pg_writes, l.pg_last - l.pg_addr + 1);
+#if USZRAM_FLAT_COMBINING
+	if (l.pg_addr == l.pg_last) {
+		combine_write(l.pg_addr, BLRNG(blk_addr % BLK_PER_PG, blocks),
+			      data, orig);
+		LAT_FINISH(USZRAM_LAT_WRITE_BLK, lat_start);
+		return 0;
+	}
+#endif
+#if USZRAM_ATOMIC_RANGES
+	range_lock(l.lk_first, l.lk_last, 1);
+#endif
 	if (l.pg_addr != l.pg_last) {
 		const size_type offset = blk_addr % BLK_PER_PG;
 		const BlkRange blk = BLRNG(offset, BLK_PER_PG - offset);
@@ -459,6 +1578,7 @@ int uszram_write_blk_hint(uint_least32_t blk_addr, uint_least32_t blocks,
 			data += PAGE_SIZE;
 			blk_addr += BLK_PER_PG;
 		}
+		batch_release(&l.held, get_lock(l.lk_addr), 1);
 	}
 	for (; l.pg_addr != l.pg_last; ++l.pg_addr) {
 		write_blk(&l, BLRNG(0, BLK_PER_PG), data, orig);
@@ -467,6 +1587,11 @@ int uszram_write_blk_hint(uint_least32_t blk_addr, uint_least32_t blocks,
 	}
 	write_blk(&l, BLRNG(blk_addr % BLK_PER_PG, l.blk_end - blk_addr), data,
 		  orig);
+	batch_release(&l.held, get_lock(l.lk_addr), 1);
+#if USZRAM_ATOMIC_RANGES
+	range_unlock(l.lk_first, l.lk_last, 1);
+#endif
+	LAT_FINISH(USZRAM_LAT_WRITE_BLK, lat_start);
 
 	return 0;
 }
@@ -483,24 +1608,34 @@ int uszram_delete_pg(uint_least32_t pg_addr, uint_least32_t pages)
 		return 0;
 	if ((uint_least64_t)pg_addr + pages > USZRAM_PAGE_COUNT)
 		return -1;
+	PART_ROUTE(0, pg_addr, pages, .fn = delete_pg_msg);
 
 	PgLoop l = make_pgloop(pg_addr, pages);
+	LAT_BEGIN(lat_start);
+#if USZRAM_ATOMIC_RANGES
+	range_lock(l.lk_first, l.lk_last, 1);
+#endif
+	struct lock *lk;
 	pages = l.lk_addr * PG_PER_LOCK;
 	for (; l.lk_addr != l.lk_last; ++l.lk_addr) {
 		pages += PG_PER_LOCK;
 		for (; pg_addr != pages; ++pg_addr) {
-			/* Could move lock/unlock outside this loop to increase
-			 * speed but also block other threads for longer */
-			lock_as_writer  (lktbl + l.lk_addr);
-			delete_pg       (pgtbl + pg_addr);
-			unlock_as_writer(lktbl + l.lk_addr);
+			lk = batch_lock(l.held, l.lk_addr, 1);
+			delete_pg    (pgtbl + pg_addr);
+			batch_unlock (&l.held, lk, 1);
 		}
+		batch_release(&l.held, get_lock(l.lk_addr), 1);
 	}
 	for (; pg_addr != l.pg_end; ++pg_addr) {
-		lock_as_writer  (lktbl + l.lk_addr);
-		delete_pg       (pgtbl + pg_addr);
-		unlock_as_writer(lktbl + l.lk_addr);
+		lk = batch_lock(l.held, l.lk_addr, 1);
+		delete_pg    (pgtbl + pg_addr);
+		batch_unlock (&l.held, lk, 1);
 	}
+	batch_release(&l.held, get_lock(l.lk_addr), 1);
+#if USZRAM_ATOMIC_RANGES
+	range_unlock(l.lk_first, l.lk_last, 1);
+#endif
+	LAT_FINISH(USZRAM_LAT_DELETE_PG, lat_start);
 
 	return 0;
 }
@@ -511,8 +1646,13 @@ int uszram_delete_blk(uint_least32_t blk_addr, uint_least32_t blocks)
 		return 0;
 	if ((uint_least64_t)blk_addr + blocks > USZRAM_BLOCK_COUNT)
 		return -1;
+	PART_ROUTE(1, blk_addr, blocks, .fn = delete_blk_msg);
 
 	BlkLoop l = make_blkloop(blk_addr, blocks);
+	LAT_BEGIN(lat_start);
+#if USZRAM_ATOMIC_RANGES
+	range_lock(l.lk_first, l.lk_last, 1);
+#endif
 	if (l.pg_addr != l.pg_last) {
 		const size_type offset = blk_addr % BLK_PER_PG;
 		const BlkRange blk = BLRNG(offset, BLK_PER_PG - offset);
@@ -526,30 +1666,86 @@ int uszram_delete_blk(uint_least32_t blk_addr, uint_least32_t blocks)
 			delete_blk(&l, BLRNG(0, BLK_PER_PG));
 			blk_addr += BLK_PER_PG;
 		}
+		batch_release(&l.held, get_lock(l.lk_addr), 1);
 	}
 	for (; l.pg_addr != l.pg_last; ++l.pg_addr) {
 		delete_blk(&l, BLRNG(0, BLK_PER_PG));
 		blk_addr += BLK_PER_PG;
 	}
 	delete_blk(&l, BLRNG(blk_addr % BLK_PER_PG, l.blk_end - blk_addr));
+	batch_release(&l.held, get_lock(l.lk_addr), 1);
+#if USZRAM_ATOMIC_RANGES
+	range_unlock(l.lk_first, l.lk_last, 1);
+#endif
+	LAT_FINISH(USZRAM_LAT_DELETE_BLK, lat_start);
+
+	return 0;
+}
+
+int uszram_own(unsigned part)
+{
+#if USZRAM_PARTITIONS
+	uintptr_t none = 0;
+	if (part >= USZRAM_PARTITIONS || part_mine() != PART_NONE
+	    || !atomic_compare_exchange_strong(&parts[part].owner, &none,
+					       (uintptr_t)&part_token))
+		return -1;
+	part_me = part;
+	return 0;
+#else
+	(void)part;
+	return -1;
+#endif
+}
+
+int uszram_serve(void)
+{
+#if USZRAM_PARTITIONS
+	const unsigned part = part_mine();
+	return part == PART_NONE ? -1 : part_serve(part);
+#else
+	return -1;
+#endif
+}
 
+unsigned uszram_partition(uint_least32_t pg_addr)
+{
+#if USZRAM_PARTITIONS
+	return pg_addr / PART_PAGES;
+#else
+	(void)pg_addr;
 	return 0;
+#endif
+}
+
+unsigned uszram_pg_shard(uint_least32_t pg_addr)
+{
+#if USZRAM_NUMA_SHARDS
+	return pg_addr / PG_PER_LOCK / SHARD_LOCKS;
+#else
+	(void)pg_addr;
+	return 0;
+#endif
+}
+
+uint_least64_t uszram_next_pg(uint_least64_t pg_addr)
+{
+	return occ_next(pg_addr);
 }
 
 _Bool uszram_pg_exists(uint_least32_t pg_addr)
 {
 	if (pg_addr > USZRAM_PAGE_COUNT - 1)
 		return 0;
-	return pgtbl[pg_addr].data;
+	return occ_test(pg_addr);
 }
 
 _Bool uszram_pg_is_huge(uint_least32_t pg_addr)
 {
 	if (pg_addr > USZRAM_PAGE_COUNT - 1)
 		return 0;
-	struct lock *const lk = lktbl + pg_addr / PG_PER_LOCK;
-
-	lock_as_reader(lk);
+	PART_ROUTE(0, pg_addr, 1, .fn = pg_is_huge_msg);
+	struct lock *const lk = lock_stripe(pg_addr / PG_PER_LOCK, 0);
 	const _Bool huge = is_huge(pgtbl + pg_addr);
 	unlock_as_reader(lk);
 	return huge;
@@ -559,10 +1755,12 @@ int uszram_pg_heap(uint_least32_t pg_addr)
 {
 	if (pg_addr > USZRAM_PAGE_COUNT - 1)
 		return -1;
-	struct lock *const lk = lktbl + pg_addr / PG_PER_LOCK;
-
-	lock_as_reader(lk);
-	const size_type size = get_size(pgtbl + pg_addr);
+	PART_ROUTE(0, pg_addr, 1, .fn = pg_heap_msg);
+	struct lock *const lk = lock_stripe(pg_addr / PG_PER_LOCK, 0);
+	const struct page *pg = pgtbl + pg_addr;
+	size_type size = get_size(pg);
+	if (pg_is_inline(pg))
+		size -= get_size_primary(pg);
 	unlock_as_reader(lk);
 	return size;
 }
@@ -577,11 +1775,224 @@ int uszram_pg_size(uint_least32_t pg_addr)
 
 uint_least64_t uszram_total_size(void)
 {
-	return sizeof pgtbl + sizeof lktbl + uszram_total_heap();
+	uint_least64_t size = sizeof pgtbl + sizeof occ_pages + sizeof occ_words
+			      + uszram_total_heap();
+#if USZRAM_DYNAMIC_LOCKS
+	size += lktbl_bytes;
+#else
+	size += sizeof lktbl;
+#endif
+#if USZRAM_HOT_PG_BYTES
+	size += sizeof hot_sets + sizeof hot_data + sizeof hot_seen;
+#endif
+#if USZRAM_FLAT_COMBINING
+	size += sizeof combq;
+#endif
+#if USZRAM_FINGERPRINTS
+	size += sizeof pgfp;
+#endif
+	return size;
+}
+
+static inline unsigned size_bucket(size_type size)
+{
+	if (size == 0)
+		return 0;
+	const uint_least64_t bucket = (size - 1u) * (uint_least64_t)
+				      USZRAM_SIZE_BUCKETS / PAGE_SIZE;
+	// With metadata, a page can take a little more than PAGE_SIZE
+	return bucket < USZRAM_SIZE_BUCKETS ? bucket : USZRAM_SIZE_BUCKETS - 1;
+}
+
+/* scan_pgs() adds the usage of the stored pages from pg_addr to pg_end to
+ * snap and, unless regions is NULL, to regions (see uszram-shm.h).
+ */
+struct uszram_shm_region;
+
+static void scan_pgs(struct uszram_stats *snap,
+		     struct uszram_shm_region *regions, uint_least64_t pg_addr,
+		     uint_least64_t pg_end)
+{
+	for (uint_least64_t i = occ_next(pg_addr); i < pg_end;
+	     i = occ_next(i + 1)) {
+		const struct page *const pg = pgtbl + i;
+		const size_type size = get_size(pg);
+		snap->compr_bytes += size;
+		snap->alloc_overhead += get_alloc_size(pg)
+					 - get_size_primary(pg);
+		++snap->size_hist[size_bucket(size)];
+#if USZRAM_SHM_STATS
+		if (regions) {
+			struct uszram_shm_region *const region
+				= regions + i / USZRAM_SHM_PG_PER_REGION;
+			++region->pages_stored;
+			region->compr_bytes += size;
+		}
+#endif
+	}
+#if !USZRAM_SHM_STATS
+	(void)regions;
+#endif
+}
+
+#if USZRAM_PARTITIONS
+struct scan {
+	struct uszram_stats       *snap;
+	struct uszram_shm_region  *regions;
+};
+
+/* scan_msg() runs scan_pgs() on the pages of msg with their stripes locked.
+ * Like snapshot(), it bypasses USZRAM_LOCK_PROFILE.
+ */
+static int scan_msg(const struct part_msg *msg)
+{
+	const struct scan *const scan = msg->arg;
+	const uint_least32_t lk_first = msg->addr / PG_PER_LOCK,
+			     lk_last = ((uint_least64_t)msg->addr + msg->count
+					- 1) / PG_PER_LOCK;
+	for (uint_least32_t i = lk_first; i <= lk_last; ++i)
+		(lock_as_reader)(get_lock(i));
+	scan_pgs(scan->snap, scan->regions, msg->addr,
+		 (uint_least64_t)msg->addr + msg->count);
+	for (uint_least32_t i = lk_first; i <= lk_last; ++i)
+		(unlock_as_reader)(get_lock(i));
+	return 0;
+}
+#endif
+
+/* snapshot() does the work of uszram_get_stats() and, unless regions is NULL,
+ * adds the usage of each region of the page table to regions. With
+ * USZRAM_PARTITIONS, each partition is scanned by its owner in turn, so the
+ * snapshot is only consistent within each partition. The sweep over the locks
+ * calls the lock backend directly, so it doesn't count in USZRAM_LOCK_PROFILE.
+ */
+static void snapshot(struct uszram_stats *snap,
+		     struct uszram_shm_region *regions)
+{
+	*snap = (struct uszram_stats){0};
+#if USZRAM_PARTITIONS
+	part_route(0, 0, (struct part_msg){
+		.fn = scan_msg,
+		.count = USZRAM_PAGE_COUNT,
+		.arg = &(struct scan){snap, regions},
+	});
+#else
+#  if USZRAM_DYNAMIC_LOCKS
+	lktbl_lock_all();
+#  else
+	for (uint_least64_t i = 0; i != LOCK_COUNT; ++i)
+		(lock_as_reader)(get_lock(i));
+#  endif
+	scan_pgs(snap, regions, 0, USZRAM_PAGE_COUNT);
+#endif
+	snap->total_size         = uszram_total_size();
+	snap->total_heap         = STAT_SUM(compr_data_size);
+	snap->pages_stored       = STAT_SUM(pages_stored);
+	snap->huge_pages         = STAT_SUM(huge_pages);
+	snap->num_compr          = STAT_SUM(num_compr);
+	snap->failed_compr       = STAT_SUM(failed_compr);
+	snap->pg_writes          = STAT_SUM(pg_writes);
+	snap->elided_writes      = STAT_SUM(elided_writes);
+	snap->bytes_read         = STAT_SUM(bytes_read);
+	snap->bytes_decompressed = STAT_SUM(bytes_decompressed);
+#if USZRAM_DYNAMIC_LOCKS
+	lktbl_unlock_all();
+#elif !USZRAM_PARTITIONS
+	for (uint_least64_t i = 0; i != LOCK_COUNT; ++i)
+		(unlock_as_reader)(get_lock(i));
+#endif
+}
+
+int uszram_get_stats(struct uszram_stats *snap)
+{
+	snapshot(snap, NULL);
+	return 0;
+}
+
+int uszram_publish_stats(void)
+{
+#if USZRAM_SHM_STATS
+	while (atomic_flag_test_and_set(&shm_publishing))
+		sched_yield();
+	int ret = -1;
+	if (shm == NULL && shm_create())
+		goto out;
+	struct uszram_shm_region regions[USZRAM_SHM_REGIONS] = {{0}};
+	struct uszram_stats snap;
+	uint_least64_t latency[USZRAM_LAT_COUNT][3];
+	snapshot(&snap, regions);
+	for (int i = 0; i < USZRAM_LAT_COUNT; ++i) {
+		latency[i][0] = uszram_latency(i, 0.5);
+		latency[i][1] = uszram_latency(i, 0.99);
+		latency[i][2] = uszram_latency(i, 0.999);
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	// Keep the segment inconsistent for as short as possible
+	const uint_least32_t seq = atomic_load_explicit(&shm->seq,
+							memory_order_relaxed);
+	atomic_store_explicit(&shm->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	shm->stats = snap;
+	memcpy(shm->latency, latency, sizeof latency);
+	memcpy(shm->regions, regions, sizeof regions);
+	++shm->published;
+	shm->time_ns = (uint_least64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+	atomic_store_explicit(&shm->seq, seq + 2, memory_order_release);
+	ret = 0;
+out:
+	atomic_flag_clear(&shm_publishing);
+	return ret;
+#else
+	return -1;
+#endif
+}
+
+uint_least64_t uszram_latency(enum uszram_lat what, double quantile)
+{
+#if USZRAM_LATENCY_SAMPLE
+	return lat_quantile(what, quantile);
+#else
+	(void)what, (void)quantile;
+	return 0;
+#endif
+}
+
+int uszram_hot_locks(struct uszram_lock_prof *top, unsigned n)
+{
+#if USZRAM_LOCK_PROFILE
+	unsigned found = 0;
+	for (uint_least64_t i = 0; i != PROF_SLOTS; ++i) {
+		const struct uszram_lock_prof prof = {
+			.lock         = i,
+			.acquisitions = prof_table[i].acquisitions,
+			.contended    = prof_table[i].contended,
+			.wait_ns      = prof_table[i].wait_ns,
+			.hold_ns      = prof_table[i].hold_ns,
+		};
+		if (prof.acquisitions == 0)
+			continue;
+		// Insertion into the hottest so far, by wait and then by use
+		unsigned j = found < n ? found++ : n;
+		for (; j && (top[j - 1].wait_ns < prof.wait_ns
+			     || (top[j - 1].wait_ns == prof.wait_ns
+				 && top[j - 1].acquisitions
+				    < prof.acquisitions)); --j)
+			if (j < n)
+				top[j] = top[j - 1];
+		if (j < n)
+			top[j] = prof;
+	}
+	return found;
+#else
+	(void)top, (void)n;
+	return -1;
+#endif
 }
 
-uint_least64_t uszram_total_heap  (void) {return stats.compr_data_size;}
-uint_least64_t uszram_pages_stored(void) {return stats.pages_stored;   }
-uint_least64_t uszram_huge_pages  (void) {return stats.huge_pages;     }
-uint_least64_t uszram_num_compr   (void) {return stats.num_compr;      }
-uint_least64_t uszram_failed_compr(void) {return stats.failed_compr;   }
+uint_least64_t uszram_total_heap  (void) {return STAT_SUM(compr_data_size);}
+uint_least64_t uszram_pages_stored(void) {return STAT_SUM(pages_stored);   }
+uint_least64_t uszram_huge_pages  (void) {return STAT_SUM(huge_pages);     }
+uint_least64_t uszram_num_compr   (void) {return STAT_SUM(num_compr);      }
+uint_least64_t uszram_failed_compr(void) {return STAT_SUM(failed_compr);   }
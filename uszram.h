@@ -23,7 +23,7 @@
 #define USZRAM_PAGE_SHIFT  12u
 #define USZRAM_BLOCK_COUNT (1ul << 24)
 
-/* Change the next 3 definitions to select the memory allocator, compressor, and
+/* Change the next 4 definitions to select the memory allocator, compressor, and
  * caching strategy. The allocator uses standard malloc unless you link the
  * program with jemalloc (like cc *.c -ljemalloc).
  *
@@ -40,11 +40,59 @@
  * read blocks to the beginning of the page to speed up future reads of those
  * blocks when Z API or LZ4 is used.
  * - USZRAM_LIST2_CACHE uses a recently-read list to cache 2 blocks in each page
+ * - USZRAM_LISTN_CACHE uses a frequency sketch to cache USZRAM_CACHE_SLOTS
+ *   blocks in each page
+ * - USZRAM_GLOBAL_CACHE learns which USZRAM_CACHE_SLOTS blocks are read most
+ *   often across the whole store and caches them in every page, which suits
+ *   data where the same blocks of each page are hot
  * - USZRAM_NO_CACHING disables caching
+ *
+ * The fourth definition only matters with USZRAM_LISTN_CACHE or
+ * USZRAM_GLOBAL_CACHE. It is the number of blocks cached in each page and must
+ * be at least 1, at most 64, and at most the number of blocks per page. With
+ * USZRAM_LISTN_CACHE, each slot adds 4 bytes to the metadata of every page.
  */
 #define USZRAM_BASIC
 #define USZRAM_LZ4
 #define USZRAM_LIST2_CACHE
+#define USZRAM_CACHE_SLOTS 4u
+
+/* Change the next definition to configure inline storage.
+ *
+ * Highly compressible pages (e.g., mostly zeros) compress to a few dozen bytes,
+ * for which a heap allocation costs more than the data itself, plus a pointer
+ * chase on every read. Compressed pages of at most USZRAM_INLINE_BYTES bytes
+ * are instead stored in the page table, in place of the heap pointer, which
+ * widens every page table entry to hold them. uszram_pg_heap() and
+ * uszram_total_heap() don't count inline data. 0 disables inline storage, and
+ * values up to the size of a pointer take no extra memory. It can't be combined
+ * with USZRAM_PACKED_PAGE.
+ */
+#define USZRAM_INLINE_BYTES 0u
+
+/* Change the next definition to configure the page table.
+ *
+ * USZRAM_PACKED_PAGE set to 1 packs each page's metadata (the heap pointer,
+ * compressed size, huge flag, and cache data) into a single 8-byte word instead
+ * of a 16-byte struct, halving the memory taken by the page table and the cache
+ * misses of random lookups. It also stores same-filled pages, in which every
+ * byte is the same, without any heap data. It requires pages of at most 32 KiB
+ * and USZRAM_GLOBAL_CACHE or USZRAM_NO_CACHING, and assumes that allocations
+ * are 8-byte aligned and addresses fit in 48 bits (see uszram-page.h). 0 keeps
+ * the unpacked struct.
+ */
+#define USZRAM_PACKED_PAGE 0
+
+/* Change the next definition to configure the hot page cache.
+ *
+ * USZRAM_HOT_PG_BYTES is the memory budget, in bytes, of a cache of fully
+ * decompressed pages shared by all threads (see caches/hot-pg-cache.h). Reading
+ * a page (or blocks of a page) kept in it costs a copy instead of a
+ * decompression. Pages enter the cache when they are read repeatedly and leave
+ * it when they are written or evicted. It must be 0, which disables the cache,
+ * or at least 8 pages.
+ */
+#define USZRAM_HOT_PG_BYTES 0u
 
 /* Change the next 2 definitions to configure the handling of large pages.
  *
@@ -65,7 +113,30 @@
 #define USZRAM_MAX_NHUGE_PERCENT 75u
 #define USZRAM_HUGE_WAIT         64u
 
-/* Change the next 2 definitions to configure locking.
+/* Change the next 2 definitions to configure write combining.
+ *
+ * Writing a few blocks to a compressed page normally means decompressing and
+ * recompressing the whole page. With write combining, block writes to a
+ * compressed page instead go to an uncompressed copy of it (a write buffer),
+ * which is recompressed only when the buffer is flushed. Reads of the page are
+ * served from the buffer in the meantime, while uszram_pg_is_huge(),
+ * uszram_pg_heap(), etc. describe the page as of its last compression.
+ *
+ * USZRAM_WBUF_PAGES is the maximum number of write buffers that can exist at
+ * once, each taking a little more than the page size on the heap. Pages
+ * controlled by the same lock (see USZRAM_PG_PER_LOCK) share at most one
+ * buffer, so a buffered page is flushed when another page under its lock needs
+ * the buffer. 0 disables write combining.
+ *
+ * USZRAM_WBUF_WAIT bounds how long a page stays buffered: the buffer is flushed
+ * after USZRAM_WBUF_WAIT updates, counted as for USZRAM_HUGE_WAIT. Buffers can
+ * also be flushed with uszram_flush(), e.g., on a timer or under memory
+ * pressure. USZRAM_WBUF_WAIT must be at least 1.
+ */
+#define USZRAM_WBUF_PAGES 0u
+#define USZRAM_WBUF_WAIT  256u
+
+/* Change the next 5 definitions to configure locking.
  *
  * USZRAM_PG_PER_LOCK adjusts lock granularity for multithreading. It is the
  * maximum number of pages that can be controlled by a single lock. It must be
@@ -75,9 +146,180 @@
  * - USZRAM_STD_MTX selects a plain mutex from the C standard library
  * - USZRAM_PTH_MTX selects a plain mutex from the pthread library
  * - USZRAM_PTH_RW selects a readers-writer lock from the pthread library
+ * - USZRAM_FUTEX_RW selects a 4-byte readers-writer lock that prefers writers,
+ *   spins briefly, and then sleeps on a futex (see locks/uszram-futex-rw.h)
+ * - USZRAM_BRAVO selects a big-reader lock that lets readers on different cores
+ *   avoid writing the same cache line, at the cost of slower writers, which
+ *   suits read-mostly workloads (see locks/uszram-bravo.h)
+ *
+ * USZRAM_LOCK_BATCH is the maximum number of pages that an operation spanning
+ * several pages controlled by the same lock handles per lock acquisition.
+ * Larger batches save lock round trips on large sequential operations but make
+ * other threads wait longer for the lock. It must be at least 1, which takes
+ * the lock for every page, and at most 255.
+ *
+ * USZRAM_ATOMIC_RANGES set to 1 makes every operation atomic: it takes the
+ * locks of all the pages it covers, in address order, before touching any of
+ * them and holds them to the end, so that other operations see all of it or
+ * none of it. uszram_write_pg() compresses the pages before taking the locks,
+ * at the cost of a temporary heap buffer about the size of the data, and the
+ * pages' cached blocks start over as for newly stored pages. Block writes still
+ * decompress and recompress their pages with the locks held. Readers and
+ * writers of large ranges hold their locks longer, so other threads wait
+ * longer, and USZRAM_LOCK_BATCH has no effect. 0 locks each lock stripe
+ * separately.
+ *
+ * USZRAM_DYNAMIC_LOCKS set to 1 replaces the fixed table of one lock per
+ * USZRAM_PG_PER_LOCK pages (a lock stripe) with a smaller table that grows at
+ * runtime, without stopping the store, while threads often find locks taken
+ * (see locks/lock-table.h). Stripes are mapped to locks by hashing, so adjacent
+ * hot stripes rarely share a lock. uszram_resize_locks() can also resize the
+ * table. It can't be combined with USZRAM_ATOMIC_RANGES. 0 keeps the fixed
+ * table.
  */
-#define USZRAM_PG_PER_LOCK 4u
+#define USZRAM_PG_PER_LOCK   4u
 #define USZRAM_PTH_MTX
+#define USZRAM_LOCK_BATCH    1u
+#define USZRAM_ATOMIC_RANGES 0
+#define USZRAM_DYNAMIC_LOCKS 0
+
+/* Change the next definition to configure latency sampling.
+ *
+ * With USZRAM_LATENCY_SAMPLE set above 0, each thread times one in
+ * USZRAM_LATENCY_SAMPLE of its calls to the uszram_read_*(), uszram_write_*(),
+ * and uszram_delete_*() functions, along with the lock waits, decompressions,
+ * compressions, and allocations within them, into histograms that
+ * uszram_latency() reads percentiles from (see uszram-latency.h). Timing takes
+ * two clock reads per call or phase, so a rate of 64 or so costs well under 1%.
+ * 0 disables sampling.
+ */
+#define USZRAM_LATENCY_SAMPLE 0u
+
+/* Change the next definition to configure lock profiling.
+ *
+ * USZRAM_LOCK_PROFILE set to 1 counts, for the lock of every lock stripe, how
+ * often it was taken, how often it had to be waited for, and the total time
+ * spent waiting for and holding it (see locks/lock-profile.h), so that
+ * uszram_hot_locks() can tell which stripes are hot. Stripes that are always
+ * contended suggest a smaller USZRAM_PG_PER_LOCK, and a few stripes with most
+ * of the waiting suggest skewed access. With USZRAM_DYNAMIC_LOCKS, it counts
+ * per lock of the lock table instead. It reads the clock twice per lock
+ * acquisition. 0 disables profiling.
+ */
+#define USZRAM_LOCK_PROFILE 0
+
+/* Change the next 2 definitions to configure the statistics segment.
+ *
+ * USZRAM_SHM_STATS set to 1 lets uszram_publish_stats() publish the statistics
+ * of uszram_get_stats(), the percentiles of uszram_latency(), and the usage of
+ * each of 64 ranges of pages into the POSIX shared memory object named
+ * USZRAM_SHM_NAME (see uszram-shm.h), where monitors in other processes, like
+ * tools/shm-stat.c, can poll them without slowing the store down. The object
+ * is created by the first publication and removed by uszram_exit(), and only
+ * one store at a time can use a given name. Some systems need the program to
+ * be linked with -lrt. 0 disables the segment.
+ */
+#define USZRAM_SHM_STATS 0
+#define USZRAM_SHM_NAME  "/uszram-stats"
+
+/* Change the next definition to parallelize setup and teardown.
+ *
+ * USZRAM_SETUP_THREADS set above 1 makes uszram_init(), uszram_exit(), and
+ * uszram_delete_all() split the lock stripes into that many ranges and
+ * initialize the locks and pages, or delete the pages, of each range in a
+ * thread of its own, which can make them several times faster for large
+ * stores. A range whose thread can't be created is done by the calling thread.
+ * The program must be linked with -pthread (or C11 threads with
+ * USZRAM_STD_MTX). 1 does everything in the calling thread.
+ */
+#define USZRAM_SETUP_THREADS 1u
+
+/* Change the next definition to partition the store among threads.
+ *
+ * USZRAM_PARTITIONS set above 0 splits the lock stripes into that many
+ * partitions of consecutive page addresses, each of which a thread can own
+ * (see uszram_own() and locks/lock-partition.h). The owner of a partition
+ * skips the locks of its pages entirely, so threads working on their own
+ * partitions don't share any lock. Other threads' operations on an owned
+ * partition are forwarded to its owner, who runs them the next time it calls
+ * into the store or uszram_serve(), which is much slower, so this suits
+ * programs that already divide pages among threads. Partitions that no one
+ * owns are locked as usual. Operations on ranges spanning partitions are split
+ * at partition boundaries, so even with USZRAM_ATOMIC_RANGES, they are only
+ * atomic within each partition, and so is uszram_get_stats(). Can't be used
+ * with USZRAM_DYNAMIC_LOCKS. 0 disables partitioning.
+ */
+#define USZRAM_PARTITIONS 0u
+
+/* Change the next definition to combine concurrent block writes.
+ *
+ * USZRAM_FLAT_COMBINING set to 1 has writes of blocks within one page queue up
+ * on their lock stripe before taking its lock (see uszram-combine.h). The
+ * thread that gets the lock does every queued write, and those to the same
+ * page together, decompressing and compressing it once for all of them,
+ * instead of once each. This helps when many threads write blocks of the same
+ * hot pages; otherwise it only adds a few atomic operations per write. It
+ * costs a pointer per lock stripe. 0 disables combining.
+ */
+#define USZRAM_FLAT_COMBINING 0
+
+/* Change the next definition to skip rewrites of unchanged pages.
+ *
+ * USZRAM_FINGERPRINTS set to 1 keeps a 32-bit fingerprint of each page last
+ * stored by uszram_write_pg() (see uszram-fingerprint.h). A page written with
+ * the same fingerprint is compared with the stored page, which takes a
+ * decompression, and left alone if they match, saving the compression and
+ * reallocation; elided_writes in struct uszram_stats counts these. This suits
+ * programs that often rewrite pages unchanged, e.g., when checkpointing. It
+ * costs 4 bytes per page and a fast hash of every page written. Block writes
+ * and deletes clear their page's fingerprint. 0 disables fingerprints.
+ */
+#define USZRAM_FINGERPRINTS 0
+
+/* Change the next 4 definitions to configure where the page table and the
+ * lock table (unless it's dynamic) are placed in memory (see
+ * uszram-placement.h). These only apply on Linux, and the kernel may ignore
+ * them.
+ *
+ * USZRAM_TABLE_HUGEPAGES set to 1 aligns the tables to 2 MiB and asks for them
+ * to be backed by transparent huge pages, so that lookups at random page
+ * addresses take far fewer TLB misses. THP must be enabled in "madvise" or
+ * "always" mode.
+ *
+ * USZRAM_NUMA_INTERLEAVE set to 1 spreads the pages of the tables evenly
+ * across the NUMA nodes the process may use, so that on hosts with several
+ * sockets, lookups are shared by the memory of all of them. Otherwise,
+ * USZRAM_NUMA_NODE set to a node number binds the tables to that node, which
+ * suits a store used only by threads running on it. -1 leaves placement to the
+ * kernel, which usually puts each page on the node of the thread that first
+ * touches it (see USZRAM_SETUP_THREADS).
+ *
+ * USZRAM_NUMA_SHARDS set above 0 splits the lock stripes into that many
+ * shards of consecutive page addresses and, instead of the two options above,
+ * puts the part of the tables for shard i on NUMA node i where possible (see
+ * uszram_pg_shard()). That only keeps a shard's accesses local if they're made
+ * by threads running on its node. With USZRAM_PARTITIONS set to the same value,
+ * partition i is shard i, so a thread on node i that owns it has other
+ * threads' operations on the shard forwarded to it (see uszram_own()), which
+ * also keeps compressed pages local, since they're allocated by the thread
+ * writing them, usually from memory on its node. Otherwise, the program has to
+ * hand requests to threads on the right node itself. With USZRAM_SETUP_THREADS
+ * set to the same value, each shard is also initialized by a thread of its
+ * own. 0 disables sharding.
+ */
+#define USZRAM_TABLE_HUGEPAGES 0
+#define USZRAM_NUMA_INTERLEAVE 0
+#define USZRAM_NUMA_NODE       -1
+#define USZRAM_NUMA_SHARDS     0u
+
+/* USZRAM_CONFIG, if defined (like cc -DUSZRAM_CONFIG='"my-config.h"'), names a
+ * header included here, relative to this one, that can #undef and redefine any
+ * of the definitions above, so that other configurations, like the test
+ * configurations in test/, can be built from the same tree.
+ */
+#ifdef USZRAM_CONFIG
+#  include USZRAM_CONFIG
+#endif
 
 
 /* Don't change any of the following lines.
@@ -87,6 +329,72 @@
 #define USZRAM_BLK_PER_PG (1u << (USZRAM_PAGE_SHIFT - USZRAM_BLOCK_SHIFT))
 #define USZRAM_PAGE_COUNT (USZRAM_BLOCK_COUNT / USZRAM_BLK_PER_PG	\
 			   + (USZRAM_BLOCK_COUNT % USZRAM_BLK_PER_PG != 0))
+#define USZRAM_SIZE_BUCKETS 16u
+
+/* What uszram_latency() can report on: the public operations (write_blk
+ * including write_blk_hint), then the phases within them.
+ */
+enum uszram_lat {
+	USZRAM_LAT_READ_PG,
+	USZRAM_LAT_READ_BLK,
+	USZRAM_LAT_WRITE_PG,
+	USZRAM_LAT_WRITE_BLK,
+	USZRAM_LAT_DELETE_PG,
+	USZRAM_LAT_DELETE_BLK,
+	USZRAM_LAT_LOCK,
+	USZRAM_LAT_DECOMPRESS,
+	USZRAM_LAT_COMPRESS,
+	USZRAM_LAT_ALLOC,
+	USZRAM_LAT_COUNT
+};
+
+
+/* struct uszram_lock_prof is the profile of a lock, as reported by
+ * uszram_hot_locks() since the last uszram_exit(). The times are in
+ * nanoseconds, and hold_ns is only meaningful if the lock isn't held.
+ */
+struct uszram_lock_prof {
+	uint_least64_t  lock,		// Lock stripe, or index in the lock
+					// table with USZRAM_DYNAMIC_LOCKS
+			acquisitions,
+			contended,	// Acquisitions that had to wait
+			wait_ns,
+			hold_ns;
+};
+
+
+/* struct uszram_stats is a snapshot of the statistics of the store, filled in
+ * by uszram_get_stats(). The first six fields are as returned by the functions
+ * of the same names. The counts of writes and reads are since the last
+ * uszram_exit(), like num_compr, so
+ * - num_compr / pg_writes is the write amplification: compressions per page
+ *   written, less than 1 if write buffers absorb writes and more if blocks are
+ *   written a few at a time
+ * - bytes_decompressed / bytes_read is the read amplification: bytes
+ *   decompressed per byte read (see also USZRAM_CACHE_SLOTS)
+ * - alloc_overhead / total_heap is the allocator's overhead
+ * elided_writes is 0 unless USZRAM_FINGERPRINTS is set.
+ * size_hist[i] is the number of stored pages of at most (i + 1) / 16 of the
+ * page size, and more than i / 16 except in size_hist[0]. Huge pages are in
+ * the last bucket, and the buckets just under USZRAM_MAX_NHUGE_PERCENT count
+ * the pages that a lower threshold would store uncompressed.
+ */
+struct uszram_stats {
+	uint_least64_t  total_size,
+			total_heap,
+			pages_stored,
+			huge_pages,
+			num_compr,
+			failed_compr,
+			compr_bytes,	// Sum of the compressed page sizes
+			alloc_overhead,	// Heap lost to the allocator, or 0
+					// if the allocator can't tell
+			pg_writes,	// Pages written by uszram_write_*()
+			elided_writes,	// Pages of those found unchanged
+			bytes_read,	// Bytes returned by uszram_read_*()
+			bytes_decompressed,	// Bytes decompressed for them
+			size_hist[USZRAM_SIZE_BUCKETS];
+};
 
 
 /* uszram_init() initializes locks and metadata to a valid state. It can safely
@@ -157,8 +465,65 @@ int uszram_delete_pg(uint_least32_t pg_addr, uint_least32_t pages);
  */
 int uszram_delete_all(void);
 
-/* uszram_pg_exists() returns whether the page at pg_addr has a heap allocation.
- * This is always true if it contains any nonzero data. Thread-safe.
+/* uszram_flush() recompresses all pages held in write buffers and frees the
+ * buffers (see USZRAM_WBUF_PAGES). Does nothing if write combining is
+ * disabled. Thread-safe.
+ */
+int uszram_flush(void);
+
+/* uszram_lock_count() returns the number of locks controlling the pages, which
+ * with USZRAM_DYNAMIC_LOCKS is the current size of the lock table. Thread-safe.
+ */
+uint_least64_t uszram_lock_count(void);
+
+/* uszram_resize_locks() resizes the lock table of USZRAM_DYNAMIC_LOCKS to
+ * 'locks' locks rounded up to a power of two, but at least 64 and at most one
+ * per lock stripe (rounded up). Returns -1 without USZRAM_DYNAMIC_LOCKS or if
+ * out of memory, otherwise 0. Thread-safe.
+ */
+int uszram_resize_locks(uint_least64_t locks);
+
+/* uszram_own() makes the calling thread the owner of partition 'part' of
+ * USZRAM_PARTITIONS until uszram_exit(). Returns -1 without USZRAM_PARTITIONS,
+ * if there is no such partition, if it already has an owner, or if the thread
+ * already owns one, otherwise 0. Since other threads wait for the owner to run
+ * their operations on the partition, the owner must keep calling into the
+ * store or uszram_serve() while they might, and must not exit before
+ * uszram_exit(). Not thread-safe with operations on the partition, so it is
+ * best called before other threads start using the store.
+ */
+int uszram_own(unsigned part);
+
+/* uszram_serve() runs the operations that other threads forwarded to the
+ * partition of the calling thread and returns how many there were, or -1 if
+ * the thread owns no partition. Thread-safe.
+ */
+int uszram_serve(void);
+
+/* uszram_partition() returns the partition of the page at pg_addr with
+ * USZRAM_PARTITIONS, otherwise 0. Thread-safe.
+ */
+unsigned uszram_partition(uint_least32_t pg_addr);
+
+/* uszram_pg_shard() returns the shard of the page at pg_addr with
+ * USZRAM_NUMA_SHARDS, otherwise 0. Shard i's metadata is placed on NUMA node i
+ * where possible, but the kernel may put it elsewhere, e.g., if there is no
+ * node i. Thread-safe.
+ */
+unsigned uszram_pg_shard(uint_least32_t pg_addr);
+
+/* uszram_next_pg() returns the address of the first page at or after pg_addr
+ * for which uszram_pg_exists() is true, or USZRAM_PAGE_COUNT if there is none,
+ * skipping 64 pages at a time, or 4096 if none of them are stored. Stored pages
+ * are tracked by a bitmap taking about a bit per page. Thread-safe, though a
+ * page may be written or deleted right after it's checked.
+ */
+uint_least64_t uszram_next_pg(uint_least64_t pg_addr);
+
+/* uszram_pg_exists() returns whether any data is stored for the page at
+ * pg_addr, usually in a heap allocation (but see USZRAM_INLINE_BYTES and
+ * USZRAM_PACKED_PAGE). This is always true if it contains any nonzero data.
+ * Thread-safe.
  */
 _Bool uszram_pg_exists(uint_least32_t pg_addr);
 
@@ -212,5 +577,40 @@ uint_least64_t uszram_num_compr(void);
  */
 uint_least64_t uszram_failed_compr(void);
 
+/* uszram_get_stats() fills in *snap (see struct uszram_stats). Unlike the
+ * functions above, which may be called in the middle of other operations, it
+ * takes every lock as a reader, so the page table and what's derived from it
+ * (pages_stored, compr_bytes, size_hist, etc.) are consistent: no write or
+ * delete is half done. The counters of work done (pg_writes, bytes_read,
+ * num_compr, etc.) aren't: some are updated outside the locks, and readers may
+ * run alongside, so they can be a little behind or ahead of the rest. It scans
+ * the whole page table, so writers are held up for a while. Returns 0.
+ * Thread-safe.
+ */
+int uszram_get_stats(struct uszram_stats *snap);
+
+/* uszram_latency() returns the given quantile (e.g., 0.99 for p99) of the
+ * sampled latencies of 'what' since the last uszram_exit(), in nanoseconds and
+ * within 1/8 of the true value, or 0 if there are no samples or
+ * USZRAM_LATENCY_SAMPLE is 0. quantile must be at least 0 and at most 1.
+ * Thread-safe.
+ */
+uint_least64_t uszram_latency(enum uszram_lat what, double quantile);
+
+/* uszram_hot_locks() fills in top[0] through top[n - 1] with the profiles of
+ * the n locks that were waited for longest (or if none were, taken most often),
+ * hottest first. Returns the number of profiles filled in, less than n if
+ * fewer locks were taken, or -1 if USZRAM_LOCK_PROFILE is 0. Thread-safe.
+ */
+int uszram_hot_locks(struct uszram_lock_prof *top, unsigned n);
+
+/* uszram_publish_stats() takes a snapshot of the statistics, as
+ * uszram_get_stats() does, and publishes it in the shared memory segment of
+ * USZRAM_SHM_STATS, e.g., every second from a timer. Returns -1 if
+ * USZRAM_SHM_STATS is 0 or the segment couldn't be created, otherwise 0.
+ * Thread-safe.
+ */
+int uszram_publish_stats(void);
+
 
 #endif // USZRAM_H